@@ -25,7 +25,9 @@ extern "C" {
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <sys/xattr.h>
 #include <time.h>
+#include <stdint.h>
 }
 
 #include <iostream>
@@ -41,6 +43,16 @@ extern "C" {
 #include "fusepod_ipod.h"
 #include "fusepod_constants.h"
 #include "fusepod_util.h"
+#include "fusepod_upload.h"
+#include "fusepod_readahead.h"
+#include "fusepod_cache.h"
+#include "fusepod_headers.h"
+#include "fusepod_commit.h"
+#include "fusepod_slots.h"
+#include "fusepod_journal.h"
+#include "fusepod_import.h"
+#include "fusepod_events.h"
+#include "fusepod_virtual.h"
 
 using namespace std;
 
@@ -55,6 +67,182 @@ static bool syncing;
 static string syncing_file;
 static string currently_syncing;
 
+/**
+ * State kept for an open file, for files which need it. Stored in
+ * fuse_file_info::fh.
+ */
+struct OpenFile {
+    enum Type { TRACK, EVENTS, VIRTUAL, LIBRARY };
+    OpenFile (Type type) : type (type) {}
+    virtual ~OpenFile () {}
+    Type type;
+};
+
+/** State kept for an open song */
+struct OpenTrack : OpenFile {
+    OpenTrack () : OpenFile (TRACK) {}
+    /** Used to find the song on the iPod once it needs to be read */
+    string path;
+    int flags;
+    guint64 dbid;
+    off_t size;
+    /** -1 until the song is read from the iPod or the cache */
+    int fd;
+    /** True if fd is the song in the cache */
+    bool cached;
+    /** The null pointer unless fd is the song on the iPod */
+    ReadAhead * readahead;
+    /** The null pointer unless the song is being copied into the cache */
+    CacheFill * cache_fill;
+};
+
+/** State kept for an open events file */
+struct EventReader : OpenFile {
+    EventReader () : OpenFile (EVENTS) {}
+    /** The sequence number of the next event to read */
+    unsigned long next;
+    /** Lines which didn't fit into the last read */
+    string pending;
+};
+
+/** State kept for an open virtual file, eg statistics */
+struct VirtualReader : OpenFile {
+    VirtualReader (VirtualContent * content) : OpenFile (VIRTUAL), content (content) {}
+    /** The version of the file when it was opened */
+    VirtualContent * content;
+};
+
+/** State kept for an open library export */
+struct LibraryReader : OpenFile {
+    LibraryReader () : OpenFile (LIBRARY) {}
+    /** The tracks when the file was opened */
+    vector<Track*> tracks;
+    /** The next track to write a record for */
+    size_t next;
+    /** fusepod->get_removed_count () when tracks was last checked */
+    unsigned long removed;
+    /** Records made but not read yet, and where they start in the file */
+    string buffer;
+    off_t offset;
+};
+
+static pthread_mutex_t open_track_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+inline static OpenFile * get_open_file (struct fuse_file_info * fi) {
+    return (OpenFile*) (uintptr_t) fi->fh;
+}
+
+/** Files whose content FUSEPod makes, by path. Needs fusepod->mutex */
+static map<string, VirtualFile*> virtual_files;
+
+/**
+ * A playlist as an M3U file. The songs are listed by their path in the
+ * view chosen by the playlist_view option, relative to the Playlists
+ * directory, so players can load the whole playlist with one read.
+ */
+class PlaylistFile : public VirtualFile {
+  public:
+    PlaylistFile (const string & name) : name (name) {}
+
+  protected:
+    virtual unsigned long get_version () {
+        Playlist * playlist = fusepod->find_playlist (name);
+        return playlist ? fusepod->get_playlist_version (playlist) : 0;
+    }
+
+    virtual string generate () {
+        Playlist * playlist = fusepod->find_playlist (name);
+        if (!playlist)
+            return "";
+
+        ostringstream m3u;
+        m3u << "#EXTM3U\n";
+
+        for (GList * i = playlist->members; i; i = i->next) {
+            Track * track = (Track*) i->data;
+            m3u << "#EXTINF:" << track->tracklen / 1000 << ","
+                << fusepod_check_string (track->artist ? track->artist : "") << " - "
+                << fusepod_check_string (track->title ? track->title : "") << "\n"
+                << ".." << fusepod->get_view_path (track) << "\n";
+        }
+
+        return m3u.str ();
+    }
+
+  private:
+    string name;
+};
+
+/**
+ * Returns the VirtualFile at path, whose node is node, or the null pointer.
+ * The files of playlists are made the first time they are looked up.
+ */
+static VirtualFile * find_virtual_file (Node * node, const char * path) {
+    map<string, VirtualFile*>::iterator i = virtual_files.find (path);
+    if (i != virtual_files.end ())
+        return i->second;
+
+    if (node->value.track || !S_ISREG (node->value.mode) || !node->parent ||
+        dir_playlists != node->parent->value.text)
+        return 0;
+
+    string filename = node->value.text;
+    size_t ext = filename.size () - playlist_file_ext.size ();
+    if (filename.size () <= playlist_file_ext.size () ||
+        filename.compare (ext, string::npos, playlist_file_ext) != 0)
+        return 0;
+
+    /* Keyed by the node's own name, which may differ in case from path */
+    string key = "/" + dir_playlists + "/" + filename;
+    i = virtual_files.find (key);
+    if (i != virtual_files.end ())
+        return i->second;
+
+    return virtual_files [key] = new PlaylistFile (filename.substr (0, ext));
+}
+
+static void library_open (LibraryReader * lr);
+static int library_read (LibraryReader * lr, char * buf, size_t size, off_t offset);
+
+/** Blocks until there are events, instead of returning end of file */
+static int events_read (EventReader * er, char * buf, size_t size) {
+    if (er->pending.empty () && !fusepod->events->wait (er->next, er->pending))
+        return 0;
+
+    size_t bytes_read = min (size, er->pending.size ());
+    memcpy (buf, er->pending.data (), bytes_read);
+    er->pending.erase (0, bytes_read);
+    return bytes_read;
+}
+
+/** Opens the file of an open song on the iPod, unless it already is */
+static int open_track_on_ipod (OpenTrack * of) {
+    MutexLock open_lock (open_track_mutex);
+
+    if (of->fd != -1)
+        return 0;
+
+    string realpath;
+
+    {
+        MutexLock lock (fusepod->mutex);
+
+        Node * tn = fusepod->get_node (of->path.c_str ());
+        if (tn == 0 || !tn->value.track)
+            return -ENOENT;
+        realpath = fusepod->get_real_path (tn->value);
+    }
+
+    int fd = open (realpath.c_str (), of->flags);
+    if (fd == -1)
+        return -errno;
+
+    of->readahead = new ReadAhead (fd, of->size);
+    of->fd = fd;
+
+    return 0;
+}
+
 
 /** Returns true if the transfer directory is a prefix of path */
 inline static bool transfer_in_dir (const char * path) {
@@ -117,16 +305,194 @@ static void transfer_remove_empty_dirs (Node * node, const string & path, bool c
 }
 
 
-/** Returns fusepod->get_statistics with syncing info */
-static string fusepod_get_stats () {
-    if (syncing) /* Add syncing stats */
-        return fusepod->get_statistics () +
-            "Currently Syncing: " + currently_syncing + "\n";
-    else
-        return fusepod->get_statistics ();
+/**
+ * A song being written into a view directory. It is written straight into a
+ * free file in the iPod's Music directory, and added to the iTunesDB once
+ * nothing is writing it.
+ */
+struct PendingWrite {
+    string ipod_path;
+    string real_path;
+    int writers;
+};
+
+/** Keyed by path in the FUSEPod filesystem. Needs fusepod->mutex */
+static map<string, PendingWrite> pending_writes;
+
+static PendingWrite * get_pending_write (const char * path) {
+    map<string, PendingWrite>::iterator i = pending_writes.find (path);
+    return i == pending_writes.end () ? 0 : &i->second;
 }
 
+/** Returns the file on the iPod of a pending song, or an empty string */
+static string pending_real_path (const char * path) {
+    MutexLock lock (fusepod->mutex);
+    PendingWrite * pw = get_pending_write (path);
+    return pw ? pw->real_path : "";
+}
+
+static void pending_remove_node (const char * path) {
+    Node * node = fusepod->get_node (path);
+    if (!node)
+        return;
+
+    node->remove_from_parent ();
+    free ((void*)node->value.text);
+    delete node;
+}
+
+static void pending_remove (const char * path) {
+    PendingWrite * pw = get_pending_write (path);
+    if (!pw)
+        return;
+
+    unlink (pw->real_path.c_str ());
+    fusepod->slots->release (pw->ipod_path.c_str ());
+    pending_writes.erase (path);
+    pending_remove_node (path);
+}
+
+/**
+ * Once nothing is writing a pending song, and it has the name of a song, it
+ * is handed to the upload queue. Its tags come from the file, except for
+ * those given by where it was written. The node goes straight away, since
+ * the track takes its place.
+ * @return true if job should be pushed, without holding fusepod->mutex.
+ */
+static bool pending_finish (const char * path, UploadJob & job) {
+    PendingWrite * pw = get_pending_write (path);
+    if (!pw || pw->writers > 0 || !FUSEPod::get_filetype (path))
+        return false;
+
+    job = UploadJob (pw->real_path, false, pw->ipod_path);
+    fusepod->match_path (path, job.tags);
+
+    pending_writes.erase (path);
+    pending_remove_node (path);
+
+    return true;
+}
+
+/**
+ * Moves a pending song. Programs like rsync write to a temporary name and
+ * rename it once done. If the extension changes the file on the iPod is
+ * renamed to match.
+ */
+static int pending_rename (const char * from, const char * to, UploadJob & job, bool & push) {
+    PendingWrite pw = *get_pending_write (from);
+
+    string to_parent (to, 0, string (to).rfind ('/'));
+    Node * parent = fusepod->get_node (to_parent.c_str ());
+    if (!parent || !S_ISDIR (parent->value.mode))
+        return -ENOENT;
+
+    Node * node = fusepod->get_node (from);
+    if (!node)
+        return -ENOENT;
+
+    if (!fusepod->in_view (to))
+        return -EACCES;
+
+    string to_ext (to, string (to).rfind ('.') + 1);
+    string real_ext (pw.real_path, pw.real_path.rfind ('.') + 1);
+
+    if (FUSEPod::get_filetype (to) && strcasecmp (to_ext.c_str (), real_ext.c_str ()) != 0) {
+        string ipod_path, real_path;
+        if (!fusepod->allocate_slot (to, ipod_path, real_path))
+            return -ENOSPC;
+
+        if (rename (pw.real_path.c_str (), real_path.c_str ())) {
+            fusepod->slots->release (ipod_path.c_str ());
+            return -errno;
+        }
+
+        fusepod->slots->release (pw.ipod_path.c_str ());
+        pw.ipod_path = ipod_path;
+        pw.real_path = real_path;
+    }
+
+    NodeValue nv = node->value;
+    nv.text = strdup (string (to, string (to).rfind ('/') + 1).c_str ());
+    pending_remove_node (from);
+    parent->addChild (nv);
+
+    pending_writes.erase (from);
+    pending_writes [to] = pw;
+
+    push = pending_finish (to, job);
+
+    return 0;
+}
+
+/** Text written to the import file which does not end in a newline yet */
+static string import_buffer;
+
+/**
+ * Takes the lines written to the import file out of import_buffer. Needs
+ * fusepod->mutex.
+ * @param all If true, a last line without a newline is taken too.
+ */
+static vector<string> import_take_lines (bool all) {
+    vector<string> lines;
+    size_t start = 0, end;
+
+    while ((end = import_buffer.find ('\n', start)) != string::npos) {
+        lines.push_back (import_buffer.substr (start, end - start));
+        start = end + 1;
+    }
+
+    import_buffer.erase (0, start);
+
+    if (all && !import_buffer.empty ()) {
+        lines.push_back (import_buffer);
+        import_buffer.clear ();
+    }
+
+    return lines;
+}
+
+/** Imports lines written to the import file. Don't hold fusepod->mutex */
+static void import_lines (const vector<string> & lines) {
+    for (size_t i = 0; i < lines.size (); i++) {
+        string line = fusepod_strip_string (lines [i]);
+        if (line.empty ())
+            continue;
+
+        if (fusepod->imports->add (line))
+            cout << "Importing " << line << endl;
+        else
+            cout << "Not importing " << line << ": not an absolute path" << endl;
+    }
+}
+
+/**
+ * The statistics file. It is made again when something happens, going by
+ * the events, and at most once a second otherwise since some statistics,
+ * eg cache hits, don't have events.
+ */
+class StatisticsFile : public VirtualFile {
+  public:
+    StatisticsFile () : VirtualFile (1) {}
+
+  protected:
+    virtual unsigned long get_version () {
+        return fusepod->events->next ();
+    }
+
+    /** Returns fusepod->get_statistics with syncing info */
+    virtual string generate () {
+        string stats = fusepod->get_statistics () + ReadAhead::get_statistics ();
+
+        if (syncing) /* Add syncing stats */
+            stats += "Currently Syncing: " + currently_syncing + "\n";
+
+        return stats;
+    }
+};
+
 static int fusepod_getattr (const char *path, struct stat *stbuf) {
+    MutexLock lock (fusepod->mutex);
+
     Node * tn = fusepod->get_node (path);
     if (tn == 0)
         return -ENOENT;
@@ -137,9 +503,10 @@ static int fusepod_getattr (const char *path, struct stat *stbuf) {
         return 0;
     }
 
-    /* Update size for statistics file */
-    if (filename_stats == &(path[1]))
-        tn->value.size = fusepod_get_stats ().length ();
+    /* Update size for statistics file and the like */
+    VirtualFile * vf = find_virtual_file (tn, path);
+    if (vf)
+        tn->value.size = vf->size ();
 
     /* Update size for files in the ipod's transfer dir */
     if (transfer_in_dir (path)) {
@@ -148,6 +515,14 @@ static int fusepod_getattr (const char *path, struct stat *stbuf) {
         tn->value.size = st.st_size;
     }
 
+    /* ...and for songs being written into views */
+    PendingWrite * pw = get_pending_write (path);
+    if (pw) {
+        struct stat st;
+        if (stat (pw->real_path.c_str (), &st) == 0)
+            tn->value.size = st.st_size;
+    }
+
     memset (stbuf, 0, sizeof (struct stat));
     stbuf->st_uid   = getuid ();
     stbuf->st_gid   = getgid ();
@@ -181,7 +556,10 @@ static int fusepod_readdir (const char *path, void *buf, fuse_fill_dir_t filler,
     (void) offset;
     (void) fi;
 
-    Node * tn = fusepod->get_node (path);
+    MutexLock lock (fusepod->mutex);
+
+    // Listing a search makes it
+    Node * tn = fusepod->get_node (path, true);
     if (tn == 0 || (tn->value.mode & S_IFREG))
         return -ENOENT;
 
@@ -195,26 +573,115 @@ static int fusepod_readdir (const char *path, void *buf, fuse_fill_dir_t filler,
 }
 
 static int fusepod_open(const char *path, struct fuse_file_info *fi) {
-    Node * tn = fusepod->get_node (path);
-    if (tn == 0)
-        return -ENOENT;
-
     string realpath;
+    off_t size = 0;
+    guint64 dbid = 0;
+    bool is_track = false;
+    bool is_pending_writer = false;
+
+    fi->fh = 0;
+
+    if (filename_events == &(path[1])) {
+        /* Reads ignore the offset and block, so the page cache can't be used */
+        EventReader * er = new EventReader ();
+        er->next = fusepod->events->next ();
+        fi->fh = (uintptr_t) er;
+        fi->direct_io = 1;
+        return 0;
+    }
 
-    if (filename_add == &(path[1])) //The special file containing songs to sync
-        realpath = add_songs;
-    else if (transfer_in_dir (path)) //File in transfer directory
-        realpath = fusepod->get_transfer_path (path);
-    else if (tn->value.track) //A song
-        realpath = fusepod->get_real_path (tn->value);
-    else
+    {
+        MutexLock lock (fusepod->mutex);
+
+        Node * tn = fusepod->get_node (path);
+        if (tn == 0)
+            return -ENOENT;
+
+        VirtualFile * vf = find_virtual_file (tn, path);
+
+        if (vf) { //Made in memory. Reads see the content as it is now
+            fi->fh = (uintptr_t) new VirtualReader (vf->open ());
+            return 0;
+        }
+        else if ("/" + dir_fusepod + "/" + filename_library == path) {
+            /* Made as it is read, so reads must come in order */
+            LibraryReader * lr = new LibraryReader ();
+            library_open (lr);
+            fi->fh = (uintptr_t) lr;
+            fi->direct_io = 1;
+            return 0;
+        }
+        else if (filename_add == &(path[1])) //The special file containing songs to sync
+            realpath = add_songs;
+        else if (filename_import == &(path[1])) //Only exists in memory
+            return 0;
+        else if (transfer_in_dir (path)) //File in transfer directory
+            realpath = fusepod->get_transfer_path (path);
+        else if (get_pending_write (path)) { //Song being written into a view
+            PendingWrite * pw = get_pending_write (path);
+            realpath = pw->real_path;
+            is_pending_writer = (fi->flags & O_ACCMODE) != O_RDONLY;
+            if (is_pending_writer)
+                pw->writers++;
+        }
+        else if (tn->value.track) { //A song
+            size = tn->value.size;
+            dbid = tn->value.track->dbid;
+            is_track = true;
+        }
+        else
+            return 0;
+    }
+
+    if (is_track) {
+        /* Songs stay open so that reads don't have to find them again */
+        OpenTrack * of = new OpenTrack ();
+        of->path       = path;
+        of->flags      = fi->flags;
+        of->dbid       = dbid;
+        of->size       = size;
+        of->fd         = -1;
+        of->cached     = false;
+        of->readahead  = 0;
+        of->cache_fill = 0;
+
+        /* Songs in the cache don't touch the iPod at all */
+        if (fusepod->cache && (fi->flags & O_ACCMODE) == O_RDONLY) {
+            of->fd = fusepod->cache->open (dbid, size);
+            of->cached = of->fd != -1;
+        }
+
+        /* Neither do songs with their header in memory, until more is read */
+        bool deferred = fusepod->headers &&
+            fusepod->headers->contains (dbid, size);
+
+        if (!of->cached && !deferred) {
+            int res = open_track_on_ipod (of);
+            if (res != 0) {
+                delete of;
+                return res;
+            }
+        }
+
+        if (!of->cached && fusepod->cache)
+            of->cache_fill = fusepod->cache->begin_fill (dbid, size);
+
+        fi->fh = (uintptr_t) of;
         return 0;
+    }
 
     int res = open(realpath.c_str(), fi->flags);
-    if (res == -1)
-        return -errno;
+    if (res == -1) {
+        res = -errno;
+        if (is_pending_writer) {
+            MutexLock lock (fusepod->mutex);
+            PendingWrite * pw = get_pending_write (path);
+            if (pw)
+                pw->writers--;
+        }
+        return res;
+    }
 
-    fi->fh = res;
     close (res);
 
     return 0;
@@ -223,11 +690,14 @@ static int fusepod_open(const char *path, struct fuse_file_info *fi) {
 static int fusepod_truncate (const char * path, off_t offset) {
     string realpath;
 
+    if (filename_import == &(path[1]))
+        return 0;
+
     if (filename_add == &(path[1]))
         realpath = add_songs;
     else if (transfer_in_dir (path))
         realpath = fusepod->get_transfer_path (path);
-    else
+    else if ((realpath = pending_real_path (path)) == "")
         return -EACCES;
 
     if (truncate (realpath.c_str(), offset) != 0)
@@ -239,11 +709,23 @@ static int fusepod_truncate (const char * path, off_t offset) {
 static int fusepod_write (const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
     string real_path;
 
+    if (filename_import == &(path[1])) {
+        vector<string> lines;
+        {
+            MutexLock lock (fusepod->mutex);
+            import_buffer.append (buf, size);
+            lines = import_take_lines (false);
+        }
+
+        import_lines (lines);
+        return size;
+    }
+
     if (filename_add == &(path[1]))
         real_path = add_songs;
     else if (transfer_in_dir (path))
         real_path = fusepod->get_transfer_path (path);
-    else
+    else if ((real_path = pending_real_path (path)) == "")
         return -EACCES;
 
     int fd;
@@ -263,48 +745,84 @@ static int fusepod_write (const char *path, const char *buf, size_t size, off_t
     return res;
 }
 
-static int fusepod_read_string (const string & str, char *buf, size_t size, off_t offset) {
-    if (offset >= (off_t)str.length())
-        return -EINVAL;
-
-    int bytes_read = min ((int) (str.length () - offset), (int) size);
-    memcpy (buf, &(str.c_str ()[offset]), bytes_read);
-    return bytes_read;
-}
-
 static int fusepod_read (const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
     int fd;
     int res;
+    string realpath;
 
-    Node * tn = fusepod->get_node (path);
-    if (tn == 0)
-        return -ENOENT;
-    else if (!(tn->value.mode & S_IFREG))
-        return -EACCES;
+    if (fi && fi->fh && get_open_file (fi)->type == OpenFile::EVENTS)
+        return events_read ((EventReader*) get_open_file (fi), buf, size);
 
+    if (fi && fi->fh && get_open_file (fi)->type == OpenFile::VIRTUAL)
+        return VirtualFile::read (((VirtualReader*) get_open_file (fi))->content, buf, size, offset);
 
-    /* Checking if reading in memory files */
-    if (filename_sync == &(path[1]))
-        return fusepod_read_string (sync_script, buf, size, offset);
+    if (fi && fi->fh && get_open_file (fi)->type == OpenFile::LIBRARY)
+        return library_read ((LibraryReader*) get_open_file (fi), buf, size, offset);
 
-    else if (filename_add_files == &(path[1]))
-        return fusepod_read_string (add_files_script, buf, size, offset);
+    if (fi && fi->fh) {
+        OpenTrack * of = (OpenTrack*) get_open_file (fi);
 
-    else if (filename_stats == &(path[1]))
-        return fusepod_read_string (fusepod_get_stats (), buf, size, offset);
+        if (of->cached) {
+            res = pread (of->fd, buf, size, offset);
+            return res == -1 ? -errno : res;
+        }
 
+        res = -1;
+        if (fusepod->headers)
+            res = fusepod->headers->read (of->dbid, of->size, -1, buf, size, offset);
 
-    /* Otherwise check if file in really another file on the filesystem */
-    string realpath;
-    if (filename_add == &(path[1]))
-        realpath = add_songs;
-    else if (transfer_in_dir (path))
-        realpath = fusepod->get_transfer_path (path);
-    else
-        realpath = fusepod->get_real_path (tn->value).c_str ();
+        if (res < 0) {
+            res = open_track_on_ipod (of);
+            if (res != 0)
+                return res;
+
+            res = -1;
+            if (fusepod->headers)
+                res = fusepod->headers->read (of->dbid, of->size, of->fd, buf, size, offset);
+            if (res < 0)
+                res = of->readahead->read (buf, size, offset);
+        }
+
+        if (res > 0 && of->cache_fill)
+            fusepod->cache->fill (of->cache_fill, buf, res, offset);
+        return res;
+    }
+
+    {
+        MutexLock lock (fusepod->mutex);
+
+        Node * tn = fusepod->get_node (path);
+        if (tn == 0)
+            return -ENOENT;
+        else if (!(tn->value.mode & S_IFREG))
+            return -EACCES;
+
+
+        /* Checking if reading in memory files */
+        VirtualFile * vf = find_virtual_file (tn, path);
+        if (vf) {
+            VirtualContent * content = vf->open ();
+            int res = VirtualFile::read (content, buf, size, offset);
+            VirtualFile::close (content);
+            return res;
+        }
+
+        else if (filename_import == &(path[1]))
+            return 0;
+
+
+        /* Otherwise check if file in really another file on the filesystem */
+        if (filename_add == &(path[1]))
+            realpath = add_songs;
+        else if (transfer_in_dir (path))
+            realpath = fusepod->get_transfer_path (path);
+        else if (get_pending_write (path))
+            realpath = get_pending_write (path)->real_path;
+        else
+            realpath = fusepod->get_real_path (tn->value).c_str ();
+    }
 
 
-    (void) fi;
     fd = open(realpath.c_str(), O_RDONLY);
     if (fd == -1)
         return -errno;
@@ -323,31 +841,51 @@ static int fusepod_mknod (const char * path, mode_t mode, dev_t dev) {
         syncing = true;
         ifstream in (add_songs);
         string path;
+        vector<string> paths;
 
         /* Read songs from add_songs */
         while (!in.eof ()) {
             getline (in, path);
-            fusepod_strip_string (path);
+            path = fusepod_strip_string (path);
 
             struct stat st;
-            stat (path.c_str (), &st);
-
-            if (S_ISREG(st.st_mode)) {
-                cout << "Adding track " << path << "... ";
-                currently_syncing = path;
-                if (fusepod->upload_song (path))
-                    cout << "Successful" << endl;
-                else
-                    cout << "Failed" << endl;
-            }
+            if (stat (path.c_str (), &st) == 0 && S_ISREG(st.st_mode))
+                paths.push_back (path);
         }
 
         in.close ();
 
+        /* Remember them on the iPod, in case the sync is interrupted */
+        fusepod->journal->plan (paths);
+
+        fusepod->events->post ("sync-started");
+
+        for (size_t i = 0; i < paths.size (); i++) {
+            cout << "Adding track " << paths [i] << "... ";
+            currently_syncing = paths [i];
+            fusepod->events->post ("upload-started", paths [i]);
+            bool duplicate;
+            if (fusepod->upload_song (paths [i], true, &duplicate)) {
+                cout << (duplicate ? "Already on the iPod" : "Successful") << endl;
+                fusepod->events->post (duplicate ? "upload-skipped" : "upload-finished", paths [i]);
+            } else {
+                cout << "Failed" << endl;
+                fusepod->events->post ("upload-failed", paths [i]);
+            }
+        }
+
         /* Empty add_songs file */
         if (truncate(add_songs, 0))
             cout << "Failed to empty add_songs file" << endl;
 
+        /* Imported directories may still be being read */
+        currently_syncing = "Import";
+        fusepod->imports->wait ();
+
+        /* Songs from the transfer directory are still being uploaded */
+        currently_syncing = "Transfer";
+        fusepod->uploads->wait ();
+
         /* Recursively add songs in transfer */
         /*string transfer_path = "/" + dir_transfer;
         Node * transfer_node = fusepod->get_node(("/" + dir_transfer).c_str());
@@ -362,13 +900,48 @@ static int fusepod_mknod (const char * path, mode_t mode, dev_t dev) {
 
         syncing = false;
         currently_syncing = "";
+        fusepod->events->post ("sync-finished");
         return 0;
     }
 
-    if (!transfer_in_dir (path))
-        return -EACCES;
+    if (!transfer_in_dir (path)) {
+        /* Making a song in a view. It goes straight into the Music dir */
+        MutexLock lock (fusepod->mutex);
+
+        if (!S_ISREG (mode))
+            return -EPERM;
+
+        if (!fusepod->in_view (path))
+            return -EACCES;
+
+        if (fusepod->get_node (path))
+            return -EEXIST;
+
+        string parent_path (path, 0, string (path).rfind ('/'));
+        Node * parent = fusepod->get_node (parent_path.c_str ());
+        if (!parent || !S_ISDIR (parent->value.mode))
+            return -ENOENT;
+
+        PendingWrite pw;
+        pw.writers = 0;
+        if (!fusepod->allocate_slot (path, pw.ipod_path, pw.real_path))
+            return -ENOSPC;
+
+        if (mknod (pw.real_path.c_str (), S_IFREG | 0666, 0)) {
+            int res = -errno;
+            fusepod->slots->release (pw.ipod_path.c_str ());
+            return res;
+        }
+
+        string filename (path, string (path).rfind ('/') + 1);
+        parent->addChild (NodeValue (strdup (filename.c_str ()), S_IFREG | 0666));
+        pending_writes [path] = pw;
+
+        return 0;
+    }
 
     /* Making a file in the transfer directory */
+    MutexLock lock (fusepod->mutex);
 
     if (!S_ISREG (mode))
         return -EPERM;
@@ -401,11 +974,27 @@ static int fusepod_mknod (const char * path, mode_t mode, dev_t dev) {
 
 static int fusepod_mkdir (const char * path, mode_t mode) {
     //TODO: Add support for adding playlists
+    MutexLock lock (fusepod->mutex);
+
     Node * node = fusepod->get_node (path);
 
     if (node != 0)
         return -EEXIST;
 
+    if (fusepod->in_view (path)) {
+        /* Directories in views only exist in memory, until songs are
+         * written into them */
+        string parent (path, 0, string(path).rfind ('/'));
+        string filename (path, string(path).rfind('/')+1);
+
+        node = fusepod->get_node (parent.c_str());
+        if (!node || !S_ISDIR (node->value.mode))
+            return -ENOENT;
+
+        node->addChild (NodeValue (fusepod_get_string (filename.c_str()), MODE_DIR));
+        return 0;
+    }
+
     if (!transfer_in_dir (path))
         return -EACCES;
 
@@ -424,6 +1013,8 @@ static int fusepod_mkdir (const char * path, mode_t mode) {
 }
 
 static int fusepod_rmdir (const char * path) {
+    MutexLock lock (fusepod->mutex);
+
     Node * node = fusepod->get_node (path);
 
     if (node == 0)
@@ -432,6 +1023,9 @@ static int fusepod_rmdir (const char * path) {
     //User can only remove directories in playlist or transfer directories
     if (node->parent && dir_playlists == node->parent->value.text) {
 
+        if (!S_ISDIR (node->value.mode))
+            return -ENOTDIR;
+
         fusepod->remove_playlist (string (node->value.text));
 
     }
@@ -451,6 +1045,16 @@ static int fusepod_rmdir (const char * path) {
         free ((void*)node->value.text);
         delete node;
 
+    }
+    else if (fusepod->in_view (path) && S_ISDIR (node->value.mode)) {
+
+        if (node->begin() != node->end())
+            return -ENOTEMPTY;
+
+        //Names in views are shared, so aren't freed
+        node->remove_from_parent ();
+        delete node;
+
     }
     else
         return -EACCES;
@@ -458,31 +1062,291 @@ static int fusepod_rmdir (const char * path) {
     return 0;
 }
 
-#define XATTRS gint32 _playcount = (gint32) track->playcount; \
-    gint32 _rating = track->rating / 20; \
-    const void * xattrs [14][2] = { \
-        {"tag.title",            track->title}, \
-        {"tag.artist",           track->artist}, \
-        {"tag.album",            track->album}, \
-        {"tag.genre",            track->genre}, \
-        {"tag.comment",          track->comment}, \
-        {"tag.composer",         track->composer}, \
-        {"tag.description",      track->description}, \
-        {"tag.podcasturl",       track->podcasturl}, \
-        {"tag.podcastrss",       track->podcastrss}, \
-\
-        {"tag.track",            &track->track_nr}, \
-        {"tag.length",           &track->tracklen}, \
-        {"tag.year",             &track->year}, \
-        {"tag.playcount",        &_playcount}, \
-        {"tag.rating",           &_rating} \
-    };
-
-#define XATTRS_LEN 14
-#define XATTRS_NUM 9
+static gint32 xattr_track (Track * track)     { return track->track_nr; }
+static gint32 xattr_length (Track * track)    { return track->tracklen; }
+static gint32 xattr_year (Track * track)      { return track->year; }
+static gint32 xattr_playcount (Track * track) { return track->playcount; }
+static gint32 xattr_rating (Track * track)    { return track->rating / ITDB_RATING_STEP; }
+
+static void set_xattr_track (Track * track, gint32 val) {
+    track->track_nr = val;
+}
+
+static void set_xattr_year (Track * track, gint32 val) {
+    track->year = val;
+}
+
+static void set_xattr_playcount (Track * track, gint32 val) {
+    track->playcount = val;
+}
+
+static void set_xattr_rating (Track * track, gint32 val) {
+    track->rating = val * ITDB_RATING_STEP;
+}
+
+/**
+ * An extended attribute of a track. Either text or number is set, except
+ * for tag.all which has neither. Text attributes can always be changed,
+ * numbers only if set_number is set, to a value from 0 to max.
+ */
+struct TrackXattr {
+    const char * name;
+    size_t size; // Including the terminating null
+    gchar * Track::* text;
+    gint32 (* number) (Track * track);
+    void (* set_number) (Track * track, gint32 val);
+    gint32 max;
+};
+
+#define XATTR_NAME(name) name, sizeof (name)
+
+static const TrackXattr xattrs [] = {
+    {XATTR_NAME ("tag.title"),       &Track::title,       0, 0, 0},
+    {XATTR_NAME ("tag.artist"),      &Track::artist,      0, 0, 0},
+    {XATTR_NAME ("tag.album"),       &Track::album,       0, 0, 0},
+    {XATTR_NAME ("tag.genre"),       &Track::genre,       0, 0, 0},
+    {XATTR_NAME ("tag.comment"),     &Track::comment,     0, 0, 0},
+    {XATTR_NAME ("tag.composer"),    &Track::composer,    0, 0, 0},
+    {XATTR_NAME ("tag.description"), &Track::description, 0, 0, 0},
+    {XATTR_NAME ("tag.podcasturl"),  &Track::podcasturl,  0, 0, 0},
+    {XATTR_NAME ("tag.podcastrss"),  &Track::podcastrss,  0, 0, 0},
+
+    {XATTR_NAME ("tag.track"),     0, xattr_track,     set_xattr_track,     9999},
+    {XATTR_NAME ("tag.length"),    0, xattr_length,    0,                   0},
+    {XATTR_NAME ("tag.year"),      0, xattr_year,      set_xattr_year,      9999},
+    {XATTR_NAME ("tag.playcount"), 0, xattr_playcount, set_xattr_playcount, 0x7fffffff},
+    {XATTR_NAME ("tag.rating"),    0, xattr_rating,    set_xattr_rating,    5},
+
+    {XATTR_NAME ("tag.all"),       0, 0,               0,                   0}
+};
+
+/* Indexes into xattrs */
+enum {
+    XATTR_TITLE, XATTR_ARTIST, XATTR_ALBUM, XATTR_GENRE, XATTR_COMMENT,
+    XATTR_COMPOSER, XATTR_DESCRIPTION, XATTR_PODCASTURL, XATTR_PODCASTRSS,
+    XATTR_TRACK, XATTR_LENGTH, XATTR_YEAR, XATTR_PLAYCOUNT, XATTR_RATING,
+    XATTR_ALL, XATTRS_LEN
+};
+
+/**
+ * Finds an attribute by name. The first letter after "tag." narrows it down
+ * to at most three attributes, so this takes constant time.
+ * @return The null pointer if there is no such attribute.
+ */
+static const TrackXattr * find_xattr (const char * name) {
+    if (strncmp (name, "tag.", 4) != 0)
+        return 0;
+
+    int candidates [3] = {-1, -1, -1};
+
+    switch (name [4]) {
+    case 'a':
+        candidates [0] = XATTR_ARTIST;
+        candidates [1] = XATTR_ALBUM;
+        candidates [2] = XATTR_ALL;
+        break;
+    case 'c':
+        candidates [0] = XATTR_COMMENT;
+        candidates [1] = XATTR_COMPOSER;
+        break;
+    case 'd': candidates [0] = XATTR_DESCRIPTION; break;
+    case 'g': candidates [0] = XATTR_GENRE;       break;
+    case 'l': candidates [0] = XATTR_LENGTH;      break;
+    case 'p':
+        candidates [0] = XATTR_PODCASTURL;
+        candidates [1] = XATTR_PODCASTRSS;
+        candidates [2] = XATTR_PLAYCOUNT;
+        break;
+    case 'r': candidates [0] = XATTR_RATING;      break;
+    case 't':
+        candidates [0] = XATTR_TITLE;
+        candidates [1] = XATTR_TRACK;
+        break;
+    case 'y': candidates [0] = XATTR_YEAR;        break;
+    default:
+        return 0;
+    }
+
+    for (int i = 0; i < 3 && candidates [i] != -1; i++)
+        if (strcmp (xattrs [candidates [i]].name, name) == 0)
+            return &xattrs [candidates [i]];
+
+    return 0;
+}
+
+/**
+ * Gets the value of an attribute without allocating.
+ * @param number Space for a formatted number.
+ * @return The null pointer if the track doesn't have the attribute.
+ */
+static const char * get_xattr (Track * track, const TrackXattr * x,
+                               char number [12]) {
+    if (x->text)
+        return track->*(x->text);
+
+    snprintf (number, 12, "%d", x->number (track));
+    return number;
+}
+
+/**
+ * Returns every attribute of a track as "name=value" lines, for tag.all.
+ * Newlines and backslashes in values are escaped.
+ */
+static string get_all_xattrs (Track * track) {
+    string all;
+    char number [12];
+
+    for (int i = 0; i < XATTR_ALL; i++) {
+        const char * val = get_xattr (track, &xattrs [i], number);
+        if (!val)
+            continue;
+
+        all.append (xattrs [i].name, xattrs [i].size - 1);
+        all += '=';
+
+        for (; *val; val++) {
+            if (*val == '\n')
+                all += "\\n";
+            else if (*val == '\\')
+                all += "\\\\";
+            else
+                all += *val;
+        }
+
+        all += '\n';
+    }
+
+    return all;
+}
+
+/** Appends a field of the library export, escaping tabs and newlines */
+static void library_field (string & record, const char * val) {
+    record += '\t';
+
+    for (; val && *val; val++) {
+        if (*val == '\t')
+            record += "\\t";
+        else if (*val == '\n')
+            record += "\\n";
+        else if (*val == '\\')
+            record += "\\\\";
+        else
+            record += *val;
+    }
+}
+
+/**
+ * Starts a library export at the start, with the header. Needs
+ * fusepod->mutex.
+ */
+static void library_open (LibraryReader * lr) {
+    lr->tracks.clear ();
+    for (GList * i = fusepod->ipod->tracks; i; i = i->next)
+        lr->tracks.push_back ((Track*) i->data);
+
+    lr->next    = 0;
+    lr->removed = fusepod->get_removed_count ();
+    lr->offset  = 0;
+    lr->buffer  = "dbid";
+
+    library_field (lr->buffer, "ipod_path");
+    library_field (lr->buffer, "path");
+    for (size_t i = 0; i < fusepod->get_view_count (); i++)
+        library_field (lr->buffer, ("view" + fusepod_int_to_string (i + 1)).c_str ());
+    for (int i = 0; i < XATTR_ALL; i++)
+        library_field (lr->buffer, &(xattrs [i].name [4])); // Without "tag."
+    library_field (lr->buffer, "size");
+
+    lr->buffer += '\n';
+}
+
+/** Appends the record of a track to buf. Needs fusepod->mutex */
+static void library_record (Track * track, string & buf) {
+    char number [24];
+
+    snprintf (number, sizeof (number), "%llu", (unsigned long long) track->dbid);
+    buf += number;
+
+    library_field (buf, track->ipod_path);
+    library_field (buf, fusepod->get_real_path (track).c_str ());
+    for (size_t i = 0; i < fusepod->get_view_count (); i++)
+        library_field (buf, fusepod->get_view_path (track, i).c_str ());
+    for (int i = 0; i < XATTR_ALL; i++)
+        library_field (buf, get_xattr (track, &xattrs [i], number));
+
+    snprintf (number, sizeof (number), "%d", track->size);
+    library_field (buf, number);
+
+    buf += '\n';
+}
+
+/**
+ * Reads the library export, which has one line for every track. Records
+ * are made as they are read, so only about one read's worth is in memory.
+ * Reading from before the last read starts again from the beginning.
+ */
+static int library_read (LibraryReader * lr, char * buf, size_t size, off_t offset) {
+    MutexLock lock (fusepod->mutex);
+
+    if (offset < lr->offset)
+        library_open (lr);
+
+    /* Don't write records for tracks which have been freed */
+    if (lr->removed != fusepod->get_removed_count ()) {
+        set<Track*> current;
+        for (GList * i = fusepod->ipod->tracks; i; i = i->next)
+            current.insert ((Track*) i->data);
+
+        vector<Track*> tracks (lr->tracks.begin (), lr->tracks.begin () + lr->next);
+        for (size_t i = lr->next; i < lr->tracks.size (); i++)
+            if (current.count (lr->tracks [i]))
+                tracks.push_back (lr->tracks [i]);
+
+        lr->tracks.swap (tracks);
+        lr->removed = fusepod->get_removed_count ();
+    }
+
+    while (lr->offset + (off_t) lr->buffer.size () < offset + (off_t) size &&
+           lr->next < lr->tracks.size ()) {
+        /* Records before offset are made only to find where it is */
+        if (lr->offset + (off_t) lr->buffer.size () <= offset) {
+            lr->offset += lr->buffer.size ();
+            lr->buffer.clear ();
+        }
+
+        library_record (lr->tracks [lr->next++], lr->buffer);
+    }
+
+    if (offset >= lr->offset + (off_t) lr->buffer.size ())
+        return 0;
+
+    size_t start = offset - lr->offset;
+    size_t bytes_read = min (size, lr->buffer.size () - start);
+    memcpy (buf, lr->buffer.data () + start, bytes_read);
 
+    lr->buffer.erase (0, start + bytes_read);
+    lr->offset = offset + bytes_read;
+
+    return bytes_read;
+}
+
+/**
+ * Copies an attribute value, including its terminating null, into buf.
+ */
+static int copy_xattr (const char * val, size_t len, char * buf, size_t size) {
+    if (size == 0)
+        return len;
+
+    if (len > size)
+        return -ERANGE;
+
+    memcpy (buf, val, len);
+    return len;
+}
 
 static int fusepod_listxattr (const char * path, char * attrs, size_t size) {
+    MutexLock lock (fusepod->mutex);
+
     Node * node = fusepod->get_node (path);
     if (!node)
         return -ENOENT;
@@ -490,33 +1354,29 @@ static int fusepod_listxattr (const char * path, char * attrs, size_t size) {
     if (!node->value.track)
         return 0;
 
-    size_t count = 0, pos = 0;
+    size_t pos = 0;
     Track * track = node->value.track;
 
-    XATTRS
-
     for (int i = 0; i < XATTRS_LEN; i++) {
-        if (i < XATTRS_NUM && !xattrs [i][1])
+        const TrackXattr & x = xattrs [i];
+        if (x.text && !(track->*(x.text)))
             continue;
 
-        size_t len = strlen ((char*)xattrs [i][0]) + 1;
-
-        if (size == 0) {
-            count += len;
-            continue;
+        if (size != 0) {
+            if (pos + x.size > size)
+                return -ERANGE;
+            memcpy (attrs + pos, x.name, x.size);
         }
 
-        if (len > size + pos)
-            return -ERANGE;
-
-        memcpy (attrs + pos, xattrs [i][0], len);
-        pos += len;
+        pos += x.size;
     }
 
-    return size == 0 ? count : pos;
+    return pos;
 }
 
 static int fusepod_getxattr (const char * path, const char * attr, char * buf, size_t size) {
+    MutexLock lock (fusepod->mutex);
+
     Node * node = fusepod->get_node (path);
     if (!node)
         return -ENOENT;
@@ -526,47 +1386,88 @@ static int fusepod_getxattr (const char * path, const char * attr, char * buf, s
 
     Track * track = node->value.track;
 
-    XATTRS
+    const TrackXattr * x = find_xattr (attr);
+    if (!x)
+        return -EACCES; //-ENOATTR;
 
-    for (int i = 0; i < XATTRS_LEN; i++) {
-        if (strcmp ((char*)xattrs [i][0], attr) != 0)
-            continue;
+    if (x == &xattrs [XATTR_ALL]) {
+        string all = get_all_xattrs (track);
+        return copy_xattr (all.c_str (), all.size () + 1, buf, size);
+    }
 
-        if (!xattrs [i][1])
-            return -EACCES; //-ENOATTR;
+    char number [12];
+    const char * val = get_xattr (track, x, number);
+    if (!val)
+        return -EACCES; //-ENOATTR;
 
-        char * val;
+    return copy_xattr (val, strlen (val) + 1, buf, size);
+}
 
-        if (i < XATTRS_NUM) {
-            val = (char*)xattrs[i][1];
-        }
-        else {
-            val = new char [11]; //Max length of gint32 string is 10
-            snprintf (val, 11, "%d", *(gint32*)(xattrs[i][1]));
-            val [10] = 0;
-        }
+/**
+ * Changes a tag of a track. The track is moved to where its new tags put it
+ * in the filesystem layout, and the iTunesDB is written a little later so
+ * that changing many tracks only writes it once. Setting a tag to the value
+ * it already has changes nothing.
+ */
+static int fusepod_setxattr (const char * path, const char * attr, const char * val, size_t size, int flags) {
+    MutexLock lock (fusepod->mutex);
 
-        size_t len = strlen (val) + 1;
+    Node * node = fusepod->get_node (path);
+    if (!node)
+        return -ENOENT;
 
-        if (size == 0) {
-            if (i >= XATTRS_NUM) delete[] val;
-            return len;
-        }
+    if (!node->value.track)
+        return -EACCES;
 
-        if (len > size) {
-            if (i >= XATTRS_NUM) delete[] val;
-            return -ERANGE;
-        }
+    Track * track = node->value.track;
 
-        strcpy (buf, val);
+    const TrackXattr * x = find_xattr (attr);
+    if (!x || (!x->text && !x->set_number))
+        return -EACCES;
 
-        if (i >= XATTRS_NUM)
-            delete[] val;
+    // Values may or may not include the terminating null
+    string value (val, size);
+    if (value.size () > 0 && value [value.size () - 1] == 0)
+        value.resize (value.size () - 1);
+
+    gint32 number = 0;
+    if (x->set_number) {
+        char * end;
+        long l = strtol (value.c_str (), &end, 10);
+        if (value.empty () || *end != 0 || l < 0 || l > x->max)
+            return -EINVAL;
+        number = l;
+    }
 
-        return len;
+    // Tags which getxattr can't read, eg an empty title, are not set
+    char old_number [12];
+    const char * old_val = get_xattr (track, x, old_number);
+    if ((flags & XATTR_CREATE) && old_val)
+        return -EEXIST;
+    if ((flags & XATTR_REPLACE) && !old_val)
+        return -ENODATA;
+
+    if (x->set_number ? x->number (track) == number :
+                        value == (old_val ? old_val : ""))
+        return 0;
+
+    // The track's place in the layout depends on its tags, so take it out
+    // before changing them.
+    fusepod->remove_track (track);
+
+    if (x->text) {
+        g_free (track->*(x->text));
+        track->*(x->text) = value.empty () ? 0 : g_strdup (value.c_str ());
     }
+    else
+        x->set_number (track, number);
 
-    return -EACCES; //-ENOATTR;
+    track->time_modified = time (0);
+
+    fusepod->add_track (track);
+    fusepod->commits->schedule ();
+
+    return 0;
 }
 
 static int fusepod_statfs (const char * path, struct statvfs * vfs) {
@@ -579,6 +1480,8 @@ static int fusepod_statfs (const char * path, struct statvfs * vfs) {
 }
 
 static int fusepod_unlink (const char * path) {
+    MutexLock lock (fusepod->mutex);
+
     Node * node = fusepod->get_node (path);
     if (node == 0)
         return -ENOENT;
@@ -591,6 +1494,11 @@ static int fusepod_unlink (const char * path) {
         return 0;
     }
 
+    if (get_pending_write (path)) {
+        pending_remove (path);
+        return 0;
+    }
+
     if (!node->value.track)
         return -EACCES;
 
@@ -600,29 +1508,166 @@ static int fusepod_unlink (const char * path) {
     return 0;
 }
 
+/**
+ * Lists the tracks under a node, with their paths relative to it.
+ */
+static void collect_tracks (Node * node, const string & path, vector<pair<Track*, string> > & tracks) {
+    if (node->value.track) {
+        tracks.push_back (make_pair (node->value.track, path));
+        return;
+    }
+
+    for (Node::iterator i = node->begin (); i != node->end (); ++i)
+        collect_tracks (*i, path + "/" + (*i)->value.text, tracks);
+}
+
+/**
+ * Changes the tags of the songs under from to match to. Needs
+ * fusepod->mutex.
+ */
+static int rename_tracks (const char * from, const char * to) {
+    Node * node = fusepod->get_node (from, true);
+
+    // Songs being written are moved by pending_rename
+    string prefix = string (from) + "/";
+    for (map<string, PendingWrite>::iterator i = pending_writes.begin (); i != pending_writes.end (); ++i)
+        if (i->first.compare (0, prefix.size (), prefix) == 0)
+            return -EBUSY;
+
+    vector<pair<Track*, string> > tracks;
+    fusepod->materialize (node);
+    collect_tracks (node, "", tracks);
+    if (tracks.empty ())
+        return -EACCES;
+
+    // Check every track can be moved before moving any
+    vector<map<char, string> > tags (tracks.size ());
+    for (size_t i = 0; i < tracks.size (); i++)
+        if (!fusepod->match_path (to + tracks [i].second, tags [i]))
+            return -EACCES;
+    for (size_t i = 0; i < tracks.size (); i++)
+        if (!fusepod->can_retag (tracks [i].first, tags [i]))
+            return -EINVAL;
+
+    for (size_t i = 0; i < tracks.size (); i++)
+        if (!fusepod->retag_track (tracks [i].first, tags [i]))
+            return -EINVAL;
+
+    return 0;
+}
+
+/**
+ * Moving a song, or a directory of songs, within the layout changes their
+ * tags to match where they are moved to. eg moving a song from /Genre/Rock
+ * to /Genre/Jazz changes its genre. Nothing is copied.
+ */
+static int fusepod_rename (const char * from, const char * to) {
+    UploadJob job;
+    bool push = false;
+    int res;
+
+    {
+        MutexLock lock (fusepod->mutex);
+
+        if (fusepod->get_node (from) == 0)
+            return -ENOENT;
+
+        if (fusepod->get_node (to))
+            return -EEXIST;
+
+        if (transfer_in_dir (from) || transfer_in_dir (to))
+            return -EACCES;
+
+        if (get_pending_write (from))
+            res = pending_rename (from, to, job, push);
+        else
+            res = rename_tracks (from, to);
+    }
+
+    if (push)
+        fusepod->uploads->push (job);
+
+    return res;
+}
+
 static int fusepod_release (const char * path, struct fuse_file_info * info) {
+    if (info->fh && (get_open_file (info)->type == OpenFile::EVENTS ||
+                     get_open_file (info)->type == OpenFile::LIBRARY)) {
+        delete get_open_file (info);
+        info->fh = 0;
+        return 0;
+    }
+
+    if (info->fh && get_open_file (info)->type == OpenFile::VIRTUAL) {
+        MutexLock lock (fusepod->mutex);
+        VirtualFile::close (((VirtualReader*) get_open_file (info))->content);
+        delete get_open_file (info);
+        info->fh = 0;
+        return 0;
+    }
+
+    if (info->fh) {
+        OpenTrack * of = (OpenTrack*) get_open_file (info);
+        delete of->readahead;
+        if (of->cache_fill)
+            fusepod->cache->end_fill (of->cache_fill);
+        if (of->fd != -1)
+            close (of->fd);
+        delete of;
+        info->fh = 0;
+        return 0;
+    }
+
+    if (filename_import == &(path[1])) {
+        vector<string> lines;
+        {
+            MutexLock lock (fusepod->mutex);
+            lines = import_take_lines (true);
+        }
+
+        import_lines (lines);
+        return 0;
+    }
+
+    UploadJob job;
+    bool push = false;
+
+    {
+        MutexLock lock (fusepod->mutex);
+
+        PendingWrite * pw = get_pending_write (path);
+        if (pw && (info->flags & O_ACCMODE) != O_RDONLY && pw->writers > 0)
+            pw->writers--;
+
+        push = pending_finish (path, job);
+    }
+
+    if (push) {
+        fusepod->uploads->push (job);
+        return 0;
+    }
+
     if (!transfer_in_dir (path))
         return 0;
 
-    /* Makes files in the Transfer directory read-only */
-    Node * node = fusepod->get_node (path);
+    string realpath = fusepod->get_transfer_path (path);
 
-    if (node)
-        node->value.mode = S_IFREG | 0444;
+    {
+        MutexLock lock (fusepod->mutex);
 
-    //TODO: Add the songs here
-    currently_syncing = fusepod->get_transfer_path (path);
-    cout << "Adding track " << currently_syncing << "... ";
-    Track * track = fusepod->upload_song (currently_syncing, false);
-    if (track)
-        cout << "Successful" << endl;
-    else
-        cout << "Failed" << endl;
+        /* The upload queue now owns the file and will move it onto the
+         * iPod, so it leaves the Transfer directory straight away */
+        Node * node = fusepod->get_node (path);
+        if (!node || !S_ISREG (node->value.mode))
+            return 0;
 
-    transfer_remove (path);
+        node->remove_from_parent ();
+        free ((void*)node->value.text);
+        delete node;
+    }
 
-    if (track)
-        fusepod->add_track (track);
+    /* Blocks while the queue is full, which holds back the writer */
+    fusepod->uploads->push (UploadJob (realpath, false));
 
     return 0;
 }
@@ -646,7 +1691,11 @@ static void write_default_config () {
     config.close ();
 }
 
-static vector<string> get_string_desc () {
+/**
+ * Reads the configuration file, writing the default one first if there is
+ * none. See fusepod_read_config.
+ */
+static vector<string> get_string_desc (Options & options) {
     istream * config = 0;
 
     if (getenv ("HOME")) {
@@ -667,15 +1716,7 @@ static vector<string> get_string_desc () {
     else
         config = new istringstream (default_config_file);
 
-    vector<string> paths;
-    string line;
-
-    while (!config->eof ()) {
-        getline (*config, line);
-        line = fusepod_strip_string (line);
-        if (line.length () > 0 && line [0] == '/')
-            paths.push_back (line);
-    }
+    vector<string> paths = fusepod_read_config (*config, options);
 
     delete config;
 
@@ -688,12 +1729,17 @@ void * fusepod_init () {
 
     srand (time (0)); //Random is used in FUSEPod::generate_filename()
 
-    vector<string> pd = get_string_desc ();
+    Options options;
+    vector<string> pd = get_string_desc (options);
 
     cout << "Reading iPod at " << ipod_mount_point << endl;
-    fusepod = new FUSEPod (ipod_mount_point, pd);
+    fusepod = new FUSEPod (ipod_mount_point, pd, options);
     cout << "Finished reading iPod" << endl;
 
+    /* Layout changes in the configuration file are applied straight away */
+    if (getenv ("HOME"))
+        fusepod->watch_config (string (getenv ("HOME")) + "/.fusepod");
+
     /* These are special extensions to the filesystem for adding songs to the
      * iPod */
     add_songs = strdup("/tmp/fusepodXXXXXX");
@@ -714,17 +1760,22 @@ void * fusepod_init () {
     sync_script += "#FUSEPod sync script\n";
     sync_script += "echo Syncing iPod...\n";
     sync_script += "if [ \"$1\" = '-watch' ]; then\n";
-    sync_script += "    stats='" + fuse_mount_point + "/" + filename_stats + "'\n";
-    sync_script += "    initial=$(grep 'Track Count' \"$stats\" | cut -b 14-)\n";
-    sync_script += "    count=$(grep -c '^.*$' '" + fuse_mount_point + "/" + filename_add + "')\n";
+    sync_script += "    # Songs in add_songs, and those the upload queue has had since starting\n";
+    sync_script += "    uploads() { awk -F': ' -v re=\"^Uploads ($1): \" '$0 ~ re { n += $2 } END { print n + 0 }' '" + fuse_mount_point + "/" + filename_stats + "'; }\n";
+    sync_script += "    added=$(grep -c '^.*$' '" + fuse_mount_point + "/" + filename_add + "')\n";
+    sync_script += "    before=$(uploads 'Completed|Failed|Skipped')\n";
+    sync_script += "    done=0\n";
+    sync_script += "    exec 3< '" + fuse_mount_point + "/" + filename_events + "'\n";
     sync_script += "    touch " + fuse_mount_point + "/" + filename_sync_do + " >/dev/null 2>&1 &\n";
-    sync_script += "    sleep 0.2\n";
-    sync_script += "    while [ 1 ]; do\n";
-    sync_script += "        current=$(grep 'Track Count' \"$stats\" | cut -b 14-)\n";
-    sync_script += "        file=$(grep 'Currently Syncing' \"$stats\")\n";
-    sync_script += "        if [ $? != 0 ]; then break; fi\n";
-    sync_script += "        clear && echo $file && echo Track $[$current-$initial] of \"$count\" && sleep 0.2\n";
+    sync_script += "    while read -r event file <&3; do\n";
+    sync_script += "        case \"$event\" in\n";
+    sync_script += "        upload-started) count=$(($added + $(uploads 'Pending|Completed|Failed|Skipped') - $before))\n";
+    sync_script += "            clear && echo Currently Syncing: $file && echo Track $[$done+1] of \"$count\" ;;\n";
+    sync_script += "        upload-finished|upload-failed|upload-skipped) done=$[$done+1] ;;\n";
+    sync_script += "        sync-finished) break ;;\n";
+    sync_script += "        esac\n";
     sync_script += "    done\n";
+    sync_script += "    exec 3<&-\n";
     sync_script += "elif [ $# = 0 ]; then touch " + fuse_mount_point + "/" + filename_sync_do + " >/dev/null 2>&1\n";
     sync_script += "else echo USAGE: $0 '[ -watch ]'\n";
     sync_script += "fi\n";
@@ -732,6 +1783,7 @@ void * fusepod_init () {
 
     sync_ipod.size = sync_script.length ();
     fusepod->root->addChild (sync_ipod);
+    virtual_files ["/" + filename_sync] = new StringFile (sync_script);
 
     NodeValue add_files (fusepod_get_string (filename_add_files.c_str ()), S_IFREG | 0555);
 
@@ -742,15 +1794,33 @@ void * fusepod_init () {
     add_files_script += "for file in \"$@\"; do\n";
     add_files_script += "    echo $file | grep ^/ &> /dev/null\n";
     add_files_script += "    if [ $? != 0 ]; then file=$PWD/$file; fi\n";
-    add_files_script += "    find \"$file\" | egrep -i '(wav|mp3|m4a)$' >> '" + fuse_mount_point + "/" + filename_add + "'\n";
+    add_files_script += "    echo \"$file\" >> '" + fuse_mount_point + "/" + filename_import + "'\n";
     add_files_script += "done\n";
 
     add_files.size = add_files_script.length ();
     fusepod->root->addChild (add_files);
+    virtual_files ["/" + filename_add_files] = new StringFile (add_files_script);
+
+    /* Songs and directories written to this file are imported */
+    NodeValue import (fusepod_get_string (filename_import.c_str ()), S_IFREG | 0666);
+    fusepod->root->addChild (import);
+
+    /* Reading this blocks until something happens, one line per event */
+    NodeValue events (fusepod_get_string (filename_events.c_str ()), S_IFREG | 0444);
+    fusepod->root->addChild (events);
+
+    /* Files for other programs, rather than people */
+    NodeValue fusepod_dir (fusepod_get_string (dir_fusepod.c_str ()), MODE_DIR);
+    Node * fusepod_node = fusepod->root->addChild (fusepod_dir);
+    if (fusepod_node) {
+        NodeValue library (fusepod_get_string (filename_library.c_str ()), MODE_FILE);
+        fusepod_node->addChild (library);
+    }
 
     /* Add statistics file */
     NodeValue stats (fusepod_get_string (filename_stats.c_str ()), S_IFREG | 0444);
     fusepod->root->addChild (stats);
+    virtual_files ["/" + filename_stats] = new StatisticsFile ();
 
     /* Add transfer directory */
     string transfer_dir = fusepod->mount_point + "/" + dir_transfer_ipod;
@@ -770,6 +1840,10 @@ static void fusepod_destroy (void * v) {
     if (add_songs)
         remove(add_songs);
 
+    for (map<string, VirtualFile*>::iterator i = virtual_files.begin (); i != virtual_files.end (); ++i)
+        delete i->second;
+    virtual_files.clear ();
+
     if (fusepod)
         delete fusepod;
 
@@ -837,6 +1911,7 @@ int main (int argc, char **argv) {
     fusepod_oper.getattr   = fusepod_getattr;
     fusepod_oper.listxattr = fusepod_listxattr;
     fusepod_oper.getxattr  = fusepod_getxattr;
+    fusepod_oper.setxattr  = fusepod_setxattr;
     fusepod_oper.access    = fusepod_access;
     fusepod_oper.readdir   = fusepod_readdir;
     fusepod_oper.open      = fusepod_open;
@@ -844,6 +1919,7 @@ int main (int argc, char **argv) {
     fusepod_oper.write     = fusepod_write;
     fusepod_oper.read      = fusepod_read;
     fusepod_oper.unlink    = fusepod_unlink;
+    fusepod_oper.rename    = fusepod_rename;
     fusepod_oper.statfs    = fusepod_statfs;
     fusepod_oper.mknod     = fusepod_mknod;
     fusepod_oper.mkdir     = fusepod_mkdir;
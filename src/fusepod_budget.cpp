@@ -0,0 +1,159 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_budget.cpp                                  *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_budget.h"
+#include "fusepod_constants.h"
+
+#include <sstream>
+#include <algorithm>
+#include <ctime>
+
+using namespace std;
+
+/** A node, and the entry for it in its parent's set of children */
+static const long long node_size = sizeof(Node) + 4 * sizeof(void*);
+
+/** Orders candidates by when they were last used */
+struct ByUse {
+    ByUse(const map<Node*, time_t> &used) : used (used) {}
+
+    time_t when(Node *node) const {
+        map<Node*, time_t>::const_iterator i = used.find(node);
+        return i == used.end() ? 0 : i->second;
+    }
+
+    bool operator()(const NodeBudget::Candidate &a,
+                    const NodeBudget::Candidate &b) const {
+        return when(a.first) < when(b.first);
+    }
+
+    const map<Node*, time_t> &used;
+};
+
+NodeBudget::NodeBudget(long long budget)
+    : budget (budget), retry_at (0), num_evicted (0), num_rebuilt (0),
+      rebuild_time (0) {
+}
+
+long long NodeBudget::memory_used() const {
+    return (long long) Node::count * node_size;
+}
+
+bool NodeBudget::over_budget() const {
+    return memory_used() > budget && time(0) >= retry_at;
+}
+
+void NodeBudget::touch(Node *dir) {
+    used[dir] = time(0);
+}
+
+void NodeBudget::evict(const vector<Candidate> &candidates) {
+    vector<Candidate> order = candidates;
+    stable_sort(order.begin(), order.end(), ByUse(used));
+
+    // Directories which are gone are forgotten
+    map<Node*, time_t> still_used;
+    for (size_t i = 0; i < order.size(); i++)
+        if (used.count(order[i].first))
+            still_used[order[i].first] = used[order[i].first];
+    used.swap(still_used);
+
+    long long target = budget / 10 * 9;
+    time_t now = time(0);
+
+    for (size_t i = 0; i < order.size() && memory_used() > target; i++) {
+        Node *dir = order[i].first;
+        if (is_evicted(dir) || dir->isLeaf())
+            continue;
+        if (used.count(dir) && now - used[dir] < budget_min_age)
+            break;
+
+        Evicted e;
+        e.path_desc = order[i].second;
+        if (!collect_tracks(dir, e.tracks))
+            continue;
+        evicted[dir] = e;
+
+        // The directory keeps its size, which counts its subdirectories
+        for (Node::iterator c = dir->begin(); c != dir->end(); ++c)
+            delete *c;
+        dir->children.clear();
+
+        used.erase(dir);
+        num_evicted++;
+    }
+
+    if (memory_used() > budget)
+        retry_at = now + 1;
+}
+
+void NodeBudget::add(Node *dir, Track *track) {
+    evicted[dir].tracks.insert(track);
+}
+
+void NodeBudget::restore(Node *dir, string &path_desc,
+                         vector<Track*> &tracks) {
+    map<Node*, Evicted>::iterator i = evicted.find(dir);
+    if (i == evicted.end())
+        return;
+
+    path_desc = i->second.path_desc;
+    tracks.assign(i->second.tracks.begin(), i->second.tracks.end());
+    evicted.erase(i);
+    num_rebuilt++;
+}
+
+void NodeBudget::rebuilt(double seconds) {
+    rebuild_time += seconds;
+}
+
+void NodeBudget::forget(Node *parent) {
+    for (Node::iterator i = parent->begin(); i != parent->end(); ++i) {
+        evicted.erase(*i);
+        used.erase(*i);
+    }
+}
+
+string NodeBudget::get_statistics() {
+    ostringstream stats;
+
+    stats << "Nodes: " << Node::count << endl
+          << "Node Memory: " << memory_used() << endl
+          << "Node Memory Budget: " << budget << endl
+          << "Directories Evicted: " << num_evicted << endl
+          << "Directories Evicted Now: " << evicted.size() << endl
+          << "Directories Rebuilt: " << num_rebuilt << endl
+          << "Rebuild Time: " << rebuild_time << endl;
+
+    return stats.str();
+}
+
+/**
+ * Collects the tracks under node.
+ * @return false if there is a node under it which isn't a track and has
+ * nothing under it, so it couldn't be rebuilt from the tracks.
+ */
+bool NodeBudget::collect_tracks(Node *node, set<Track*> &tracks) {
+    if (node->value.track) {
+        tracks.insert(node->value.track);
+        return true;
+    }
+    if (node->isLeaf())
+        return false;
+
+    for (Node::iterator i = node->begin(); i != node->end(); ++i)
+        if (!collect_tracks(*i, tracks))
+            return false;
+    return true;
+}
@@ -0,0 +1,130 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_budget.h                                    *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_BUDGET_H_
+#define _FUSEPOD_BUDGET_H_
+
+#include "fusepod_ipod.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <utility>
+#include <ctime>
+
+using std::string;
+using std::vector;
+using std::map;
+using std::set;
+using std::pair;
+
+/**
+ * Keeps the nodes of the layout within a memory budget. The directories
+ * one below the top of a view, eg Artists/Deftones, are evicted when the
+ * budget is exceeded, least recently used first. An evicted directory keeps
+ * its node, but its children are replaced by the list of its tracks, so
+ * FUSEPod can rebuild it when it is looked up again. Directories holding
+ * anything which isn't a track, eg a song being written or a directory
+ * made with mkdir, can't be rebuilt and are never evicted. Only the nodes
+ * are budgeted; their names are shared by fusepod_get_string and kept.
+ * Not thread safe; callers hold FUSEPod::mutex.
+ */
+class NodeBudget {
+  public:
+    /** A directory which can be evicted, and the path description of the
+     *  view it is in */
+    typedef pair<Node*, string> Candidate;
+
+    /**
+     * @param budget Most bytes to spend on nodes.
+     */
+    NodeBudget(long long budget);
+
+    /**
+     * @return true if the nodes use more memory than the budget, and it is
+     * worth trying to evict. After a try which couldn't get under the
+     * budget, eg because every directory was used recently, this is false
+     * for a second.
+     */
+    bool over_budget() const;
+
+    /**
+     * Notes that a directory has been used.
+     */
+    void touch(Node *dir);
+
+    bool is_evicted(Node *dir) const {
+        return !evicted.empty() && evicted.count(dir);
+    }
+
+    /**
+     * Evicts the least recently used candidates until the nodes use a bit
+     * less than the budget. Directories used in the last
+     * budget_min_age seconds are kept.
+     */
+    void evict(const vector<Candidate> &candidates);
+
+    /**
+     * Adds a track to an evicted directory without rebuilding it. Adding a
+     * track it already has does nothing.
+     */
+    void add(Node *dir, Track *track);
+
+    /**
+     * Stops a directory being evicted.
+     * @param path_desc Set to the path description of the directory's view.
+     * @param tracks Set to the tracks to add back to the directory.
+     */
+    void restore(Node *dir, string &path_desc, vector<Track*> &tracks);
+
+    /**
+     * Notes how long rebuilding a restored directory took.
+     */
+    void rebuilt(double seconds);
+
+    /**
+     * Forgets the directories in parent, which is about to be deleted.
+     */
+    void forget(Node *parent);
+
+    /**
+     * @return A multiline string with statistics, in the same format as
+     * FUSEPod::get_statistics.
+     */
+    string get_statistics();
+
+  private:
+    struct Evicted {
+        string path_desc;
+        set<Track*> tracks;
+    };
+
+    static bool collect_tracks(Node *node, set<Track*> &tracks);
+    long long memory_used() const;
+
+    long long budget;
+    /** When evict may be tried again after falling short */
+    time_t retry_at;
+
+    /** When each directory was last used */
+    map<Node*, time_t> used;
+    map<Node*, Evicted> evicted;
+
+    unsigned long num_evicted;
+    unsigned long num_rebuilt;
+    double rebuild_time;
+};
+
+#endif
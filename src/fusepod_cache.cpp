@@ -0,0 +1,265 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_cache.cpp                                   *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+extern "C" {
+#ifdef linux
+/* For pwrite() */
+#define _XOPEN_SOURCE 500
+#endif
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+}
+
+#include "fusepod_cache.h"
+#include "fusepod_util.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+static const char *part_suffix = ".part";
+
+TrackCache::TrackCache(const string &dir, off_t capacity)
+    : dir (dir), capacity (capacity), used (0), num_hits (0),
+      num_misses (0), num_evictions (0) {
+    pthread_mutex_init(&mutex, 0);
+
+    if (mkdir(dir.c_str(), 0700) && errno != EEXIST)
+        cout << "Could not create cache directory " << dir << endl;
+
+    load();
+}
+
+TrackCache::~TrackCache() {
+    pthread_mutex_destroy(&mutex);
+}
+
+int TrackCache::open(guint64 dbid, off_t size) {
+    string key = get_key(dbid, size);
+    MutexLock lock(mutex);
+
+    map<string, Entry>::iterator e = entries.find(key);
+    if (e == entries.end()) {
+        num_misses++;
+        return -1;
+    }
+
+    int fd = ::open(get_path(key).c_str(), O_RDONLY);
+    if (fd == -1) { // Someone removed it behind our back
+        used -= e->second.size;
+        lru.erase(e->second.lru);
+        entries.erase(e);
+        num_misses++;
+        return -1;
+    }
+
+    lru.splice(lru.begin(), lru, e->second.lru);
+    num_hits++;
+
+    return fd;
+}
+
+CacheFill *TrackCache::begin_fill(guint64 dbid, off_t size) {
+    if (dbid == 0 || size <= 0 || size > capacity)
+        return 0;
+
+    string key = get_key(dbid, size);
+    MutexLock lock(mutex);
+
+    if (entries.count(key) || filling.count(key))
+        return 0;
+
+    int fd = ::open(get_path(key + part_suffix).c_str(),
+                    O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1)
+        return 0;
+
+    filling.insert(key);
+
+    CacheFill *cache_fill = new CacheFill;
+    cache_fill->key = key;
+    cache_fill->fd = fd;
+    cache_fill->size = size;
+    cache_fill->failed = false;
+    pthread_mutex_init(&cache_fill->mutex, 0);
+
+    return cache_fill;
+}
+
+/**
+ * Adds the range from start to end to ranges, joining it with the ranges it
+ * touches.
+ */
+static void add_range(map<off_t, off_t> &ranges, off_t start, off_t end) {
+    map<off_t, off_t>::iterator i = ranges.upper_bound(start);
+
+    if (i != ranges.begin()) {
+        map<off_t, off_t>::iterator prev = i;
+        --prev;
+        if (prev->second >= start) {
+            start = prev->first;
+            end = max(end, prev->second);
+            ranges.erase(prev);
+        }
+    }
+
+    while (i != ranges.end() && i->first <= end) {
+        end = max(end, i->second);
+        ranges.erase(i++);
+    }
+
+    ranges[start] = end;
+}
+
+void TrackCache::fill(CacheFill *cache_fill, const char *buf, size_t size,
+                      off_t offset) {
+    {
+        MutexLock lock(cache_fill->mutex);
+        if (cache_fill->failed)
+            return;
+    }
+
+    // Only this fill's lock is taken, so other songs aren't held up by
+    // writing to local disk
+    bool ok = pwrite(cache_fill->fd, buf, size, offset) == (ssize_t) size;
+
+    MutexLock lock(cache_fill->mutex);
+    if (ok)
+        add_range(cache_fill->filled, offset, offset + size);
+    else
+        cache_fill->failed = true;
+}
+
+void TrackCache::end_fill(CacheFill *cache_fill) {
+    map<off_t, off_t> &filled = cache_fill->filled;
+    bool complete = !cache_fill->failed && filled.size() == 1 &&
+        filled.begin()->first == 0 &&
+        filled.begin()->second >= cache_fill->size;
+
+    close(cache_fill->fd);
+    pthread_mutex_destroy(&cache_fill->mutex);
+
+    MutexLock lock(mutex);
+
+    string part = get_path(cache_fill->key + part_suffix);
+
+    if (complete && rename(part.c_str(), get_path(cache_fill->key).c_str()) == 0)
+        insert(cache_fill->key, cache_fill->size);
+    else
+        unlink(part.c_str());
+
+    filling.erase(cache_fill->key);
+    delete cache_fill;
+}
+
+string TrackCache::get_statistics() {
+    MutexLock lock(mutex);
+    ostringstream stats;
+
+    stats << "Cache Hits: " << num_hits << endl
+          << "Cache Misses: " << num_misses << endl
+          << "Cache Evictions: " << num_evictions << endl
+          << "Cache Tracks: " << entries.size() << endl
+          << "Cache Size: " << used << " of " << capacity << endl;
+
+    return stats.str();
+}
+
+string TrackCache::get_key(guint64 dbid, off_t size) {
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), "%016llx-%lld", (unsigned long long) dbid,
+             (long long) size);
+    return tmp;
+}
+
+string TrackCache::get_path(const string &key) {
+    return dir + "/" + key;
+}
+
+/**
+ * Reads what is already in the cache directory. The least recently accessed
+ * songs are the first to be evicted. Partly copied songs from a previous
+ * mount are removed.
+ */
+void TrackCache::load() {
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return;
+
+    vector<pair<time_t, pair<string, off_t> > > found;
+    struct dirent *ent;
+
+    while ((ent = readdir(d))) {
+        string name = ent->d_name;
+        string path = get_path(name);
+        struct stat st;
+
+        if (name[0] == '.' || stat(path.c_str(), &st) || !S_ISREG(st.st_mode))
+            continue;
+
+        if (name.size() > strlen(part_suffix) &&
+            name.compare(name.size() - strlen(part_suffix), string::npos,
+                         part_suffix) == 0) {
+            unlink(path.c_str());
+            continue;
+        }
+
+        found.push_back(make_pair(st.st_atime, make_pair(name, st.st_size)));
+    }
+
+    closedir(d);
+
+    sort(found.begin(), found.end());
+    for (size_t i = 0; i < found.size(); i++)
+        insert(found[i].second.first, found[i].second.second);
+}
+
+/**
+ * Adds a song which is now in the cache directory. Called with mutex held.
+ */
+void TrackCache::insert(const string &key, off_t size) {
+    lru.push_front(key);
+
+    Entry &entry = entries[key];
+    entry.size = size;
+    entry.lru = lru.begin();
+    used += size;
+
+    evict();
+}
+
+/**
+ * Removes the least recently used songs until the cache fits its capacity.
+ * Songs which are open stay readable until they are closed.
+ */
+void TrackCache::evict() {
+    while (used > capacity && !lru.empty()) {
+        string key = lru.back();
+        lru.pop_back();
+
+        used -= entries[key].size;
+        entries.erase(key);
+        unlink(get_path(key).c_str());
+        num_evictions++;
+    }
+}
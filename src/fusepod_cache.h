@@ -0,0 +1,131 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_cache.h                                     *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_CACHE_H_
+#define _FUSEPOD_CACHE_H_
+
+#include <gpod/itdb.h>
+
+extern "C" {
+#include <pthread.h>
+#include <sys/types.h>
+}
+
+#include <string>
+#include <list>
+#include <map>
+#include <set>
+
+using std::string;
+using std::list;
+using std::map;
+using std::set;
+
+/**
+ * A song being copied into the cache as it is read. See TrackCache::begin_fill.
+ */
+struct CacheFill {
+    string key;
+    int fd;
+    off_t size;
+    /** The ranges written so far, from their start to their end. The song
+     *  is cached once they cover all of it */
+    map<off_t, off_t> filled;
+    /** Set if writing to the cache failed */
+    bool failed;
+    /** Protects filled and failed, since reads of a file can run at once */
+    pthread_mutex_t mutex;
+};
+
+/**
+ * A cache of songs on local storage, so that songs which are played often
+ * are read from local disk instead of the iPod. Songs are copied into the
+ * cache as they are read, once all of them has been read, and the least
+ * recently used
+ * songs are removed once the cache grows larger than its capacity.
+ * Songs are identified by their dbid and size.
+ */
+class TrackCache {
+  public:
+    /**
+     * @param dir The directory to keep the cache in. It is created if it
+     * does not exist.
+     * @param capacity The maximum size of the cache in bytes.
+     */
+    TrackCache(const string &dir, off_t capacity);
+    ~TrackCache();
+
+    /**
+     * Opens a cached song for reading.
+     * @return A file descriptor, or -1 if the song is not cached.
+     */
+    int open(guint64 dbid, off_t size);
+
+    /**
+     * Starts copying a song into the cache. Pass what is read from the song
+     * to fill, and finish with end_fill.
+     * @return The null pointer if the song can't be cached.
+     */
+    CacheFill *begin_fill(guint64 dbid, off_t size);
+
+    /**
+     * Copies data read from the song into the cache. Reads may come in any
+     * order; the song is cached once every part of it has been read. The
+     * data is written without holding the cache's lock.
+     */
+    void fill(CacheFill *cache_fill, const char *buf, size_t size,
+              off_t offset);
+
+    /**
+     * Stops filling, and frees cache_fill. If the whole song was not read it
+     * is not cached. Call it once nothing else is filling cache_fill.
+     */
+    void end_fill(CacheFill *cache_fill);
+
+    /**
+     * @return A multiline string with cache statistics, in the same format as
+     * FUSEPod::get_statistics.
+     */
+    string get_statistics();
+
+  private:
+    struct Entry {
+        off_t size;
+        list<string>::iterator lru;
+    };
+
+    string get_key(guint64 dbid, off_t size);
+    string get_path(const string &key);
+    void load();
+    void insert(const string &key, off_t size);
+    void evict();
+
+    string dir;
+    off_t capacity;
+    off_t used;
+
+    /** Most recently used first */
+    list<string> lru;
+    map<string, Entry> entries;
+    /** Songs being copied into the cache */
+    set<string> filling;
+
+    pthread_mutex_t mutex;
+
+    unsigned long num_hits;
+    unsigned long num_misses;
+    unsigned long num_evictions;
+};
+
+#endif
@@ -0,0 +1,130 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_commit.cpp                                  *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_commit.h"
+#include "fusepod_ipod.h"
+#include "fusepod_util.h"
+#include "fusepod_constants.h"
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+extern "C" {
+#include <time.h>
+}
+
+using namespace std;
+
+DeferredCommit::DeferredCommit(FUSEPod *fusepod)
+    : fusepod (fusepod), changes (0), first_change (0), last_change (0),
+      stopping (false), num_writes (0), num_coalesced (0) {
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&changed, 0);
+
+    running = !pthread_create(&thread, 0, commit_main, this);
+}
+
+DeferredCommit::~DeferredCommit() {
+    {
+        MutexLock lock(mutex);
+        stopping = true;
+        pthread_cond_signal(&changed);
+    }
+
+    if (running)
+        pthread_join(thread, 0);
+
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&mutex);
+}
+
+void DeferredCommit::schedule() {
+    MutexLock lock(mutex);
+
+    last_change = fusepod_now();
+    if (changes++ == 0)
+        first_change = last_change;
+
+    pthread_cond_signal(&changed);
+}
+
+void DeferredCommit::written() {
+    MutexLock lock(mutex);
+
+    if (changes == 0)
+        return;
+
+    num_writes++;
+    num_coalesced += changes - 1;
+    changes = 0;
+}
+
+string DeferredCommit::get_statistics() {
+    MutexLock lock(mutex);
+    ostringstream stats;
+
+    stats << "Changes Pending: " << changes << endl
+          << "Deferred Writes: " << num_writes << endl
+          << "Changes Coalesced: " << num_coalesced << endl;
+
+    return stats.str();
+}
+
+void *DeferredCommit::commit_main(void *commit) {
+    ((DeferredCommit*) commit)->run();
+    return 0;
+}
+
+void DeferredCommit::run() {
+    for (;;) {
+        {
+            MutexLock lock(mutex);
+
+            for (;;) {
+                if (stopping)
+                    return;
+
+                if (changes == 0) {
+                    pthread_cond_wait(&changed, &mutex);
+                    continue;
+                }
+
+                double due = min(last_change + commit_delay,
+                                 first_change + commit_max_delay);
+                if (fusepod_now() >= due)
+                    break;
+
+                struct timespec ts;
+                ts.tv_sec = (time_t) due;
+                ts.tv_nsec = (long) ((due - ts.tv_sec) * 1000000000.0);
+                pthread_cond_timedwait(&changed, &mutex, &ts);
+            }
+        }
+
+        // written() is called by write_db if this works
+        bool ok;
+        {
+            MutexLock lock(fusepod->mutex);
+            ok = fusepod->write_db();
+        }
+
+        if (!ok) {
+            cout << "Writing the iTunesDB failed. Trying again later" << endl;
+
+            MutexLock lock(mutex);
+            first_change = last_change = fusepod_now();
+        }
+    }
+}
@@ -0,0 +1,83 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_commit.h                                    *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_COMMIT_H_
+#define _FUSEPOD_COMMIT_H_
+
+extern "C" {
+#include <pthread.h>
+}
+
+#include <string>
+
+using std::string;
+
+class FUSEPod;
+
+/**
+ * Writes the iTunesDB in the background once changes stop coming in.
+ * Writing the iTunesDB takes a while, so changing the tags of a whole album
+ * should only write it once. It is written commit_delay seconds after the
+ * last change, or commit_max_delay seconds after the first, whichever comes
+ * first.
+ */
+class DeferredCommit {
+  public:
+    DeferredCommit(FUSEPod *fusepod);
+
+    /**
+     * Stops without writing pending changes. FUSEPod writes the iTunesDB
+     * when it is unmounted anyway.
+     */
+    ~DeferredCommit();
+
+    /**
+     * Notes that the iTunesDB has changed.
+     */
+    void schedule();
+
+    /**
+     * Notes that the iTunesDB has been written. Called by
+     * FUSEPod::write_db.
+     */
+    void written();
+
+    /**
+     * @return A multiline string with statistics, in the same format as
+     * FUSEPod::get_statistics.
+     */
+    string get_statistics();
+
+  private:
+    static void *commit_main(void *commit);
+    void run();
+
+    FUSEPod *fusepod;
+
+    /** Changes since the iTunesDB was last written */
+    unsigned long changes;
+    double first_change;
+    double last_change;
+
+    bool running;
+    bool stopping;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+
+    unsigned long num_writes;
+    unsigned long num_coalesced;
+};
+
+#endif
@@ -0,0 +1,162 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_config.cpp                                  *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_config.h"
+#include "fusepod_ipod.h"
+#include "fusepod_util.h"
+#include "fusepod_constants.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+extern "C" {
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <limits.h>
+}
+
+using namespace std;
+
+ConfigWatcher::ConfigWatcher(FUSEPod *fusepod, const string &path)
+    : fusepod (fusepod), path (path), inotify_fd (-1), running (false),
+      num_reloads (0), num_views_added (0), num_views_removed (0) {
+    size_t slash = path.rfind('/');
+    dir  = slash == string::npos ? "." : path.substr(0, slash + 1);
+    name = slash == string::npos ? path : path.substr(slash + 1);
+
+    stop_pipe[0] = stop_pipe[1] = -1;
+    pthread_mutex_init(&mutex, 0);
+}
+
+ConfigWatcher::~ConfigWatcher() {
+    if (running) {
+        char c = 0;
+        if (write(stop_pipe[1], &c, 1) != 1)
+            cout << "Could not stop watching " << path << endl;
+        pthread_join(thread, 0);
+    }
+
+    if (inotify_fd != -1)
+        close(inotify_fd);
+    if (stop_pipe[0] != -1) {
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+    }
+
+    pthread_mutex_destroy(&mutex);
+}
+
+bool ConfigWatcher::start() {
+    inotify_fd = inotify_init();
+    if (inotify_fd == -1)
+        return false;
+
+    if (inotify_add_watch(inotify_fd, dir.c_str(),
+                          IN_CLOSE_WRITE | IN_MOVED_TO) == -1)
+        return false;
+
+    if (pipe(stop_pipe) == -1) {
+        stop_pipe[0] = stop_pipe[1] = -1;
+        return false;
+    }
+
+    running = !pthread_create(&thread, 0, watch_main, this);
+    return running;
+}
+
+string ConfigWatcher::get_statistics() {
+    MutexLock lock(mutex);
+    ostringstream stats;
+
+    stats << "Configuration Reloads: " << num_reloads << endl
+          << "Views Added: " << num_views_added << endl
+          << "Views Removed: " << num_views_removed << endl;
+
+    return stats.str();
+}
+
+void *ConfigWatcher::watch_main(void *watcher) {
+    ((ConfigWatcher*) watcher)->watch();
+    return 0;
+}
+
+void ConfigWatcher::watch() {
+    while (wait_for_change()) {
+        // Editors save in a few steps. Wait until they are done
+        struct pollfd fd;
+        fd.fd = stop_pipe[0];
+        fd.events = POLLIN;
+        if (poll(&fd, 1, config_reload_delay) != 0)
+            return;
+
+        reload();
+    }
+}
+
+/**
+ * Waits for the configuration file to be written or replaced.
+ * @return false if stopping.
+ */
+bool ConfigWatcher::wait_for_change() {
+    char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        struct pollfd fds[2];
+        fds[0].fd = stop_pipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = inotify_fd;
+        fds[1].events = POLLIN;
+
+        if (poll(fds, 2, -1) == -1)
+            continue;
+        if (fds[0].revents)
+            return false;
+
+        ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len <= 0)
+            continue;
+
+        for (char *p = buf; p < buf + len;) {
+            struct inotify_event *event = (struct inotify_event*) p;
+            if (event->len > 0 && name == event->name)
+                return true;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+void ConfigWatcher::reload() {
+    ifstream config(path.c_str());
+    if (!config)
+        return;
+
+    Options options;
+    vector<string> paths_descs = fusepod_read_config(config, options);
+
+    size_t added, removed;
+    if (!fusepod->set_paths_descs(paths_descs, added, removed))
+        return;
+
+    cout << "Reloaded " << path << ": " << added << " views added, "
+         << removed << " removed" << endl;
+
+    MutexLock lock(mutex);
+    num_reloads++;
+    num_views_added += added;
+    num_views_removed += removed;
+}
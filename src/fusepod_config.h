@@ -0,0 +1,82 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_config.h                                    *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_CONFIG_H_
+#define _FUSEPOD_CONFIG_H_
+
+extern "C" {
+#include <pthread.h>
+}
+
+#include <string>
+
+using std::string;
+
+class FUSEPod;
+
+/**
+ * Watches the configuration file with inotify, and gives FUSEPod its path
+ * descriptions again when it is saved. The directory is watched rather than
+ * the file, since editors often save by renaming a new file over the old
+ * one.
+ */
+class ConfigWatcher {
+  public:
+    /**
+     * @param path The configuration file, eg ~/.fusepod
+     */
+    ConfigWatcher(FUSEPod *fusepod, const string &path);
+
+    /**
+     * Stops watching, and waits for a reload in progress to finish.
+     */
+    ~ConfigWatcher();
+
+    /**
+     * Starts watching in the background.
+     * @return false if inotify can't watch the file's directory.
+     */
+    bool start();
+
+    /**
+     * @return A multiline string with statistics, in the same format as
+     * FUSEPod::get_statistics.
+     */
+    string get_statistics();
+
+  private:
+    static void *watch_main(void *watcher);
+    void watch();
+    bool wait_for_change();
+    void reload();
+
+    FUSEPod *fusepod;
+    string path;
+    string dir;
+    string name;
+
+    int inotify_fd;
+    /** Written to when stopping, to wake the watching thread */
+    int stop_pipe[2];
+
+    bool running;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+
+    unsigned long num_reloads;
+    unsigned long num_views_added;
+    unsigned long num_views_removed;
+};
+
+#endif
@@ -31,19 +31,111 @@ const std::string filename_add_files = "add_files.sh";
 const std::string filename_sync = "sync_ipod.sh";
 const std::string filename_sync_do = "sync-ipod-now";
 const std::string filename_stats = "statistics";
+const std::string filename_import = "import";
+const std::string filename_events = "events";
+const std::string filename_library = "library.tsv";
 
 const std::string dir_transfer = "Transfer";
 const std::string dir_transfer_ipod = ".fusepod_temp";
+const std::string dir_fusepod = ".fusepod";
+const std::string dir_search = "Search";
+const std::string dir_query = "Query";
+const std::string dir_most_played = "Most Played";
+const std::string dir_top_rated = "Top Rated";
+const std::string dir_recently_added = "Recently Added";
+
+const size_t upload_queue_capacity = 32;
+const int upload_queue_workers = 2;
+const size_t upload_failures_kept = 10;
+const size_t upload_copy_chunk = 256 * 1024;
+
+/* Lines noting copies are written to the sync journal in batches of this
+ * many, rather than one fsync per song */
+const size_t journal_batch_lines = 64;
+
+const size_t fingerprint_chunk_size = 64 * 1024;
+
+const int import_workers = 4;
+
+/* Events kept for readers of the events file which fall behind */
+const size_t event_log_size = 1024;
+
+/* Searches kept in the Search directory */
+const size_t search_results_kept = 32;
+
+/* Query results remembered until the tracks change */
+const size_t query_results_kept = 64;
+
+/* Tracks listed in Most Played, Top Rated and Recently Added */
+const size_t default_top_size = 25;
+
+/* Milliseconds to wait after the configuration file is saved before
+ * reading it */
+const int config_reload_delay = 100;
+
+/* Directories used in the last this many seconds aren't evicted to keep
+ * within memory_budget */
+const time_t budget_min_age = 10;
+
+/* Views are built by several threads when mounting an iPod with at least
+ * this many songs */
+const size_t view_build_min_tracks = 2000;
+const unsigned view_build_max_workers = 16;
+
+/* Longest request line accepted on the control socket */
+const size_t control_max_request = 64 * 1024;
+
+const int orphan_scan_workers = 4;
+/* Files in the Music directory changed in the last minute may be uploads */
+const int orphan_min_age = 60;
+
+/* The iTunesDB is written this many seconds after the last change to tags */
+const double commit_delay = 2.0;
+/* ...but no later than this many seconds after the first */
+const double commit_max_delay = 30.0;
+
+const long long default_cache_size = 1024LL * 1024 * 1024;
+const long long default_header_cache_limit = 64 * 1024 * 1024;
+
+/* Read-ahead starts after this many sequential reads */
+const int readahead_trigger = 2;
+const size_t readahead_chunk = 128 * 1024;
+const size_t readahead_min_window = 256 * 1024;
+const size_t readahead_max_window = 4 * 1024 * 1024;
+/* The window grows to hold this many seconds of reading */
+const double readahead_seconds = 2.0;
 
 const std::string dir_playlists = "Playlists";
 const std::string playlist_track_format = "%a - %t.%e";
+const std::string playlist_file_ext = ".m3u";
 
 const std::string default_config_file =
 "/All/%a - %t.%e\n"
 "/Artists/%a/%A/%T - %t.%e\n"
 "/Albums/%A/%T - %a - %t.%e\n"
-"/Genre/%g/%a/%A/%T - %t.%e\n";
+"/Genre/%g/%a/%A/%T - %t.%e\n"
+"\n"
+"# Keep songs which are read often on local disk\n"
+"# cache_dir = ~/.cache/fusepod\n"
+"# cache_size = 1G\n"
+"\n"
+"# Keep the start of every song in memory, for programs that scan tags\n"
+"# header_cache = 64K\n"
+"# header_cache_limit = 64M\n"
+"# header_cache_warm = yes\n"
+"\n"
+"# Take requests from scripts over a unix socket\n"
+"# control_socket = ~/.fusepod_control\n"
+"\n"
+"# How many songs Most Played, Top Rated and Recently Added list\n"
+"# top_size = 25\n"
+"\n"
+"# Most memory to spend on the directory tree, eg for small boxes\n"
+"# memory_budget = 16M\n";
 
 #define ITUNESDB_PATH "/iPod_Control/iTunes/iTunesDB"
+#define FINGERPRINTS_PATH "/iPod_Control/iTunes/fusepod_fingerprints"
+#define ORPHAN_SCAN_PATH "/iPod_Control/iTunes/fusepod_scan"
+#define JOURNAL_PATH "/iPod_Control/iTunes/fusepod_journal"
 
 #endif
@@ -0,0 +1,514 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_control.cpp                                 *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_control.h"
+#include "fusepod_ipod.h"
+#include "fusepod_upload.h"
+#include "fusepod_import.h"
+#include "fusepod_commit.h"
+#include "fusepod_journal.h"
+#include "fusepod_readahead.h"
+#include "fusepod_util.h"
+#include "fusepod_constants.h"
+
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+extern "C" {
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+}
+
+using namespace std;
+
+struct ControlClient {
+    ControlClient(ControlServer *server, int fd) : server (server), fd (fd) {}
+    ControlServer *server;
+    int fd;
+};
+
+/**
+ * Splits a request into its tab separated fields.
+ */
+static vector<string> split_fields(const string &line) {
+    vector<string> fields;
+    size_t start = 0, end;
+
+    while ((end = line.find('\t', start)) != string::npos) {
+        fields.push_back(line.substr(start, end - start));
+        start = end + 1;
+    }
+    fields.push_back(line.substr(start));
+
+    return fields;
+}
+
+/**
+ * Reads a playlist position, which counts from 1.
+ */
+static bool parse_position(const string &s, int &pos) {
+    char *end;
+    long val = strtol(s.c_str(), &end, 10);
+    if (s.empty() || *end || val < 0 || val > 0x7fffffff)
+        return false;
+
+    pos = (int) val;
+    return true;
+}
+
+/**
+ * Lists the tracks under a node, once each. Songs are found in the order
+ * they are listed, so a directory of an album keeps its track order.
+ */
+static void collect_tracks(Node *node, vector<Track*> &tracks,
+                           set<Track*> &seen) {
+    if (node->value.track) {
+        if (seen.insert(node->value.track).second)
+            tracks.push_back(node->value.track);
+        return;
+    }
+
+    for (Node::iterator i = node->begin(); i != node->end(); ++i)
+        collect_tracks(*i, tracks, seen);
+}
+
+/**
+ * Finds the tracks under each path in the FUSEPod filesystem.
+ * @return The first path which doesn't exist, or an empty string.
+ */
+static string find_tracks(FUSEPod *fusepod, const vector<string> &paths,
+                          size_t first, vector<Track*> &tracks) {
+    set<Track*> seen;
+
+    for (size_t i = first; i < paths.size(); i++) {
+        Node *node = fusepod->get_node(paths[i].c_str(), true);
+        if (!node)
+            return paths[i];
+        fusepod->materialize(node);
+        collect_tracks(node, tracks, seen);
+    }
+
+    return "";
+}
+
+/**
+ * Writes all of s to a socket. Clients which hang up don't raise SIGPIPE.
+ */
+static bool send_all(int fd, const string &s) {
+    size_t done = 0;
+
+    while (done < s.size()) {
+        ssize_t n = send(fd, s.data() + done, s.size() - done, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+
+    return true;
+}
+
+ControlServer::ControlServer(FUSEPod *fusepod, const string &path)
+    : fusepod (fusepod), path (path), listen_fd (-1), running (false),
+      stopping (false), num_connections (0), num_requests (0) {
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&finished, 0);
+}
+
+ControlServer::~ControlServer() {
+    {
+        MutexLock lock(mutex);
+        stopping = true;
+
+        // Wakes up the threads reading from connections
+        for (set<int>::iterator i = clients.begin(); i != clients.end(); ++i)
+            shutdown(*i, SHUT_RDWR);
+    }
+
+    if (running) {
+        shutdown(listen_fd, SHUT_RDWR);
+        pthread_join(thread, 0);
+        unlink(path.c_str());
+    }
+
+    if (listen_fd != -1)
+        close(listen_fd);
+
+    {
+        MutexLock lock(mutex);
+        while (!clients.empty())
+            pthread_cond_wait(&finished, &mutex);
+    }
+
+    pthread_cond_destroy(&finished);
+    pthread_mutex_destroy(&mutex);
+}
+
+bool ControlServer::start() {
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+
+    // Only replace a socket left behind by an earlier mount
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode))
+            return false;
+        unlink(path.c_str());
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd == -1)
+        return false;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+
+    if (bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) ||
+        chmod(path.c_str(), S_IRUSR | S_IWUSR) ||
+        listen(listen_fd, SOMAXCONN)) {
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    running = !pthread_create(&thread, 0, accept_main, this);
+    return running;
+}
+
+string ControlServer::get_statistics() {
+    MutexLock lock(mutex);
+    ostringstream stats;
+
+    stats << "Control Connections: " << clients.size() << endl
+          << "Control Connections Total: " << num_connections << endl
+          << "Control Requests: " << num_requests << endl;
+
+    return stats.str();
+}
+
+void *ControlServer::accept_main(void *server) {
+    ((ControlServer*) server)->accept_clients();
+    return 0;
+}
+
+void *ControlServer::client_main(void *client) {
+    ControlClient *c = (ControlClient*) client;
+    c->server->serve(c->fd);
+    delete c;
+    return 0;
+}
+
+void ControlServer::accept_clients() {
+    for (;;) {
+        int fd = accept(listen_fd, 0, 0);
+        if (fd == -1 && (errno == EINTR || errno == ECONNABORTED))
+            continue;
+        if (fd == -1)
+            return; // The socket was shut down
+
+        MutexLock lock(mutex);
+
+        if (stopping) {
+            close(fd);
+            return;
+        }
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        pthread_t client;
+        ControlClient *c = new ControlClient(this, fd);
+        if (pthread_create(&client, &attr, client_main, c) == 0) {
+            clients.insert(fd);
+            num_connections++;
+        } else {
+            delete c;
+            close(fd);
+        }
+
+        pthread_attr_destroy(&attr);
+    }
+}
+
+/**
+ * Handles every whole request which has been read before writing their
+ * replies in one go, so pipelined requests need few system calls.
+ */
+void ControlServer::serve(int fd) {
+    string in, out;
+    char buf[4096];
+
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+
+        in.append(buf, n);
+
+        size_t start = 0, end;
+        while ((end = in.find('\n', start)) != string::npos) {
+            handle(in.substr(start, end - start), out);
+            start = end + 1;
+        }
+        in.erase(0, start);
+
+        if (in.size() > control_max_request)
+            out += "ERR Request too long\n";
+
+        if (!send_all(fd, out) || in.size() > control_max_request)
+            break;
+        out.clear();
+    }
+
+    MutexLock lock(mutex);
+    clients.erase(fd);
+    close(fd);
+    pthread_cond_broadcast(&finished);
+}
+
+void ControlServer::handle(const string &line, string &reply) {
+    string request = line;
+    if (!request.empty() && request[request.size() - 1] == '\r')
+        request.erase(request.size() - 1);
+
+    vector<string> args = split_fields(request);
+    if (args[0].empty())
+        return;
+
+    {
+        MutexLock lock(mutex);
+        num_requests++;
+    }
+
+    const string &cmd = args[0];
+
+    if (cmd == "UPLOAD")
+        upload(args, reply);
+    else if (cmd == "IMPORT")
+        import(args, reply);
+    else if (cmd == "DELETE")
+        remove(args, reply);
+    else if (cmd == "PLAYLIST")
+        playlist(args, reply);
+    else if (cmd == "COMMIT")
+        commit(reply);
+    else if (cmd == "STATS")
+        statistics(reply);
+    else
+        reply += "ERR Unknown request " + cmd + "\n";
+}
+
+/**
+ * UPLOAD <song>... queues songs for uploading. They are journaled like
+ * songs in add_songs, so they are uploaded even if FUSEPod stops first.
+ */
+void ControlServer::upload(const vector<string> &args, string &reply) {
+    if (args.size() < 2) {
+        reply += "ERR UPLOAD needs a song\n";
+        return;
+    }
+
+    vector<string> songs(args.begin() + 1, args.end());
+    for (size_t i = 0; i < songs.size(); i++) {
+        if (songs[i].empty() || songs[i][0] != '/') {
+            reply += "ERR Not an absolute path: " + songs[i] + "\n";
+            return;
+        }
+    }
+
+    fusepod->journal->plan(songs);
+
+    // Blocks while the queue is full, which holds back the client
+    for (size_t i = 0; i < songs.size(); i++)
+        fusepod->uploads->push(UploadJob(songs[i]));
+
+    reply += "OK\n";
+}
+
+/**
+ * IMPORT <pattern>... imports songs, directories and globs like the import
+ * file.
+ */
+void ControlServer::import(const vector<string> &args, string &reply) {
+    if (args.size() < 2) {
+        reply += "ERR IMPORT needs a path\n";
+        return;
+    }
+
+    for (size_t i = 1; i < args.size(); i++) {
+        if (!fusepod->imports->add(args[i])) {
+            reply += "ERR Not an absolute path: " + args[i] + "\n";
+            return;
+        }
+    }
+
+    reply += "OK\n";
+}
+
+/**
+ * DELETE <path>... removes the songs at, or under, paths in the FUSEPod
+ * filesystem from the iPod. Replies with the number removed.
+ */
+void ControlServer::remove(const vector<string> &args, string &reply) {
+    if (args.size() < 2) {
+        reply += "ERR DELETE needs a path\n";
+        return;
+    }
+
+    MutexLock lock(fusepod->mutex);
+
+    vector<Track*> tracks;
+    string missing = find_tracks(fusepod, args, 1, tracks);
+    if (missing != "") {
+        reply += "ERR No such file: " + missing + "\n";
+        return;
+    }
+
+    int removed = 0;
+    for (size_t i = 0; i < tracks.size(); i++)
+        if (fusepod->remove_song(tracks[i]))
+            removed++;
+
+    if (removed > 0)
+        fusepod->commits->schedule();
+
+    reply += "OK " + fusepod_int_to_string(removed) + "\n";
+}
+
+/**
+ * PLAYLIST CREATE <name>
+ * PLAYLIST DELETE <name>
+ * PLAYLIST ADD <name> <path> [<position>]
+ * PLAYLIST REMOVE <name> <position>
+ * PLAYLIST MOVE <name> <from> <to>
+ *
+ * Paths added may be directories, whose songs are added in order.
+ * Positions count from 1.
+ */
+void ControlServer::playlist(const vector<string> &args, string &reply) {
+    if (args.size() < 3) {
+        reply += "ERR PLAYLIST needs an action and a name\n";
+        return;
+    }
+
+    const string &action = args[1];
+    const string &name = args[2];
+
+    MutexLock lock(fusepod->mutex);
+
+    if (action == "CREATE") {
+        if (!fusepod->create_playlist(name)) {
+            reply += "ERR Can't create playlist " + name + "\n";
+            return;
+        }
+        fusepod->commits->schedule();
+        reply += "OK\n";
+        return;
+    }
+
+    Playlist *playlist = fusepod->find_playlist(name);
+    if (!playlist) {
+        reply += "ERR No such playlist: " + name + "\n";
+        return;
+    }
+
+    bool ok = false;
+    int from, to;
+
+    if (action == "DELETE" && args.size() == 3) {
+        fusepod->remove_playlist(name);
+        ok = true;
+    } else if (action == "ADD" && (args.size() == 4 || args.size() == 5)) {
+        vector<Track*> tracks;
+        if (find_tracks(fusepod, args, 3, tracks) != "") {
+            reply += "ERR No such file: " + args[3] + "\n";
+            return;
+        }
+
+        int pos = 0;
+        if (args.size() == 5 && !parse_position(args[4], pos)) {
+            reply += "ERR Bad position: " + args[4] + "\n";
+            return;
+        }
+
+        ok = !tracks.empty();
+        for (size_t i = 0; i < tracks.size() && ok; i++)
+            ok = fusepod->add_to_playlist(playlist, tracks[i],
+                                          pos ? pos + (int) i : 0);
+    } else if (action == "REMOVE" && args.size() == 4) {
+        ok = parse_position(args[3], from) &&
+            fusepod->remove_from_playlist(playlist, from);
+    } else if (action == "MOVE" && args.size() == 5) {
+        ok = parse_position(args[3], from) && parse_position(args[4], to) &&
+            fusepod->move_in_playlist(playlist, from, to);
+    } else {
+        reply += "ERR Bad PLAYLIST request\n";
+        return;
+    }
+
+    if (!ok) {
+        reply += "ERR Can't " + action + " in playlist " + name + "\n";
+        return;
+    }
+
+    fusepod->commits->schedule();
+    reply += "OK\n";
+}
+
+/**
+ * COMMIT waits for imports and uploads to finish, then writes the iTunesDB.
+ */
+void ControlServer::commit(string &reply) {
+    fusepod->imports->wait();
+    fusepod->uploads->wait();
+
+    MutexLock lock(fusepod->mutex);
+
+    if (fusepod->write_db())
+        reply += "OK\n";
+    else
+        reply += "ERR Could not write the iTunesDB\n";
+}
+
+/**
+ * STATS replies with "OK <n>" followed by the n lines of the statistics
+ * file.
+ */
+void ControlServer::statistics(string &reply) {
+    string stats;
+    {
+        MutexLock lock(fusepod->mutex);
+        stats = fusepod->get_statistics();
+    }
+    stats += ReadAhead::get_statistics();
+
+    int lines = 0;
+    for (size_t i = 0; i < stats.size(); i++)
+        if (stats[i] == '\n')
+            lines++;
+
+    reply += "OK " + fusepod_int_to_string(lines) + "\n" + stats;
+}
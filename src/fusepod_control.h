@@ -0,0 +1,96 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_control.h                                   *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_CONTROL_H_
+#define _FUSEPOD_CONTROL_H_
+
+extern "C" {
+#include <pthread.h>
+}
+
+#include <string>
+#include <vector>
+#include <set>
+
+using std::string;
+using std::vector;
+using std::set;
+
+class FUSEPod;
+
+/**
+ * Takes requests from other programs over a unix socket, so scripts don't
+ * have to go through add_songs, sync-ipod-now and statistics. Each request
+ * is one line of tab separated fields, eg "UPLOAD\t/music/song.mp3", and
+ * gets one reply line starting with "OK" or "ERR", in the order the
+ * requests were sent. A client may send many requests without waiting for
+ * the replies. Each connection is served by its own thread.
+ */
+class ControlServer {
+  public:
+    /**
+     * @param path Where to make the socket.
+     */
+    ControlServer(FUSEPod *fusepod, const string &path);
+
+    /**
+     * Closes the socket and every connection, and waits for the requests
+     * being handled to finish.
+     */
+    ~ControlServer();
+
+    /**
+     * Makes the socket and starts accepting connections in the background.
+     * @return false if the socket can't be made.
+     */
+    bool start();
+
+    /**
+     * @return A multiline string with statistics, in the same format as
+     * FUSEPod::get_statistics.
+     */
+    string get_statistics();
+
+  private:
+    static void *accept_main(void *server);
+    static void *client_main(void *client);
+    void accept_clients();
+    void serve(int fd);
+    void handle(const string &line, string &reply);
+
+    void upload(const vector<string> &args, string &reply);
+    void import(const vector<string> &args, string &reply);
+    void remove(const vector<string> &args, string &reply);
+    void playlist(const vector<string> &args, string &reply);
+    void commit(string &reply);
+    void statistics(string &reply);
+
+    FUSEPod *fusepod;
+    string path;
+    int listen_fd;
+
+    /** Connections which are open */
+    set<int> clients;
+
+    bool running;
+    bool stopping;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t finished;
+
+    unsigned long num_connections;
+    unsigned long num_requests;
+};
+
+#endif
@@ -0,0 +1,97 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_events.cpp                                  *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_events.h"
+#include "fusepod_util.h"
+
+#include <sstream>
+
+using namespace std;
+
+EventLog::EventLog(size_t capacity)
+    : capacity (capacity), first (0), stopping (false), waiting (0) {
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&posted, 0);
+}
+
+EventLog::~EventLog() {
+    pthread_cond_destroy(&posted);
+    pthread_mutex_destroy(&mutex);
+}
+
+void EventLog::post(const string &type, const string &detail) {
+    string line = type;
+    if (detail != "")
+        line += "\t" + detail;
+
+    // Each event is one line, whatever is in the detail
+    for (size_t i = 0; i < line.size(); i++)
+        if (line[i] == '\n')
+            line[i] = ' ';
+
+    MutexLock lock(mutex);
+
+    events.push_back(line + "\n");
+    if (events.size() > capacity) {
+        events.pop_front();
+        first++;
+    }
+
+    pthread_cond_broadcast(&posted);
+}
+
+unsigned long EventLog::next() {
+    MutexLock lock(mutex);
+    return first + events.size();
+}
+
+bool EventLog::wait(unsigned long &seq, string &out) {
+    MutexLock lock(mutex);
+
+    waiting++;
+    while (!stopping && seq >= first + events.size())
+        pthread_cond_wait(&posted, &mutex);
+    waiting--;
+
+    if (stopping)
+        return false;
+
+    if (seq < first) {
+        std::ostringstream lost;
+        lost << "lost\t" << first - seq << "\n";
+        out += lost.str();
+        seq = first;
+    }
+
+    for (; seq < first + events.size(); seq++)
+        out += events[seq - first];
+
+    return true;
+}
+
+void EventLog::stop() {
+    MutexLock lock(mutex);
+    stopping = true;
+    pthread_cond_broadcast(&posted);
+}
+
+string EventLog::get_statistics() {
+    MutexLock lock(mutex);
+    ostringstream stats;
+
+    stats << "Events Posted: " << first + events.size() << endl
+          << "Event Readers Waiting: " << waiting << endl;
+
+    return stats.str();
+}
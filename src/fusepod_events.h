@@ -0,0 +1,84 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_events.h                                    *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_EVENTS_H_
+#define _FUSEPOD_EVENTS_H_
+
+extern "C" {
+#include <pthread.h>
+}
+
+#include <string>
+#include <deque>
+
+using std::string;
+using std::deque;
+
+/**
+ * The most recent things FUSEPod has done, eg uploading a song or writing
+ * the iTunesDB, one line each. Readers keep the sequence number of the next
+ * event they want and block until it happens, so they don't have to poll
+ * the statistics file. Only the last few events are kept; a reader which
+ * falls behind is told how many it missed.
+ */
+class EventLog {
+  public:
+    /**
+     * @param capacity How many events to keep.
+     */
+    EventLog(size_t capacity);
+    ~EventLog();
+
+    /**
+     * Adds an event. Readers see the line "type\tdetail".
+     */
+    void post(const string &type, const string &detail = "");
+
+    /**
+     * @return The sequence number the next event will have. Readers start
+     * here, so they only see events which happen after they start.
+     */
+    unsigned long next();
+
+    /**
+     * Blocks until there are events from seq on, then appends their lines
+     * to out and moves seq past them.
+     * @return false if stopped.
+     */
+    bool wait(unsigned long &seq, string &out);
+
+    /**
+     * Wakes up every reader. Later calls to wait return false straight away.
+     */
+    void stop();
+
+    /**
+     * @return A multiline string with statistics, in the same format as
+     * FUSEPod::get_statistics.
+     */
+    string get_statistics();
+
+  private:
+    size_t capacity;
+    deque<string> events;
+    /** The sequence number of events.front() */
+    unsigned long first;
+
+    bool stopping;
+    int waiting;
+    pthread_mutex_t mutex;
+    pthread_cond_t posted;
+};
+
+#endif
@@ -0,0 +1,453 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_fingerprint.cpp                             *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_fingerprint.h"
+#include "fusepod_ipod.h"
+#include "fusepod_util.h"
+#include "fusepod_constants.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+}
+
+using namespace std;
+
+static guint32 read_be32(const unsigned char *b) {
+    return ((guint32) b[0] << 24) | ((guint32) b[1] << 16) |
+        ((guint32) b[2] << 8) | (guint32) b[3];
+}
+
+static guint32 read_le32(const unsigned char *b) {
+    return ((guint32) b[3] << 24) | ((guint32) b[2] << 16) |
+        ((guint32) b[1] << 8) | (guint32) b[0];
+}
+
+/**
+ * Finds the audio in an MP4 file. It is the contents of the mdat atom, the
+ * tags live in the moov atom.
+ */
+static bool find_mp4_payload(int fd, off_t size, off_t &start, off_t &end) {
+    unsigned char b[16];
+    off_t offset = 0;
+
+    while (offset + 8 <= size) {
+        if (pread(fd, b, 8, offset) != 8)
+            return false;
+
+        off_t header = 8;
+        off_t atom = read_be32(b);
+        if (atom == 1) { // 64 bit size follows the type
+            if (pread(fd, b + 8, 8, offset + 8) != 8)
+                return false;
+            atom = ((off_t) read_be32(b + 8) << 32) | read_be32(b + 12);
+            header = 16;
+        } else if (atom == 0) { // Atom runs to the end of the file
+            atom = size - offset;
+        }
+
+        if (atom < header)
+            return false;
+
+        if (memcmp(b + 4, "mdat", 4) == 0) {
+            start = offset + header;
+            end = min(offset + atom, size);
+            return true;
+        }
+
+        offset += atom;
+    }
+
+    return false;
+}
+
+/**
+ * Finds the audio in a WAV file. It is the contents of the data chunk, any
+ * tags are in other chunks.
+ */
+static bool find_wav_payload(int fd, off_t size, off_t &start, off_t &end) {
+    unsigned char b[8];
+    off_t offset = 12; // Skip "RIFF", the file size and "WAVE"
+
+    while (offset + 8 <= size) {
+        if (pread(fd, b, 8, offset) != 8)
+            return false;
+
+        off_t chunk = read_le32(b + 4);
+        if (memcmp(b, "data", 4) == 0) {
+            start = offset + 8;
+            end = min(start + chunk, size);
+            return true;
+        }
+
+        offset += 8 + chunk + (chunk & 1);
+    }
+
+    return false;
+}
+
+/**
+ * Works out which part of a file is audio, skipping ID3v2 and ID3v1 tags and
+ * APE tags for MP3s, and everything but the audio for MP4s and WAVs.
+ */
+static void find_payload(int fd, off_t size, off_t &start, off_t &end) {
+    unsigned char b[32];
+
+    start = 0;
+    end = size;
+
+    if (pread(fd, b, 12, 0) != 12)
+        return;
+
+    if (memcmp(b + 4, "ftyp", 4) == 0) {
+        if (!find_mp4_payload(fd, size, start, end))
+            start = 0, end = size;
+        return;
+    }
+
+    if (memcmp(b, "RIFF", 4) == 0 && memcmp(b + 8, "WAVE", 4) == 0) {
+        if (!find_wav_payload(fd, size, start, end))
+            start = 0, end = size;
+        return;
+    }
+
+    if (memcmp(b, "ID3", 3) == 0) {
+        // The tag size is a 28 bit "syncsafe" integer
+        start = 10 + (((off_t) (b[6] & 0x7f) << 21) | ((b[7] & 0x7f) << 14) |
+                      ((b[8] & 0x7f) << 7) | (b[9] & 0x7f));
+        if (b[5] & 0x10) // Footer present
+            start += 10;
+        if (start > end)
+            start = end;
+    }
+
+    if (end - start >= 128 && pread(fd, b, 3, end - 128) == 3 &&
+        memcmp(b, "TAG", 3) == 0)
+        end -= 128;
+
+    if (end - start >= 32 && pread(fd, b, 24, end - 32) == 24 &&
+        memcmp(b, "APETAGEX", 8) == 0) {
+        off_t tag = read_le32(b + 12); // Includes the footer
+        if (read_le32(b + 20) & 0x80000000) // Header present
+            tag += 32;
+        end = max(start, end - tag);
+    }
+}
+
+bool fusepod_fingerprint(const string &path, Fingerprint &fp, bool hash) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return false;
+    }
+
+    off_t start, end;
+    find_payload(fd, st.st_size, start, end);
+    fp.length = end - start;
+
+    if (!hash) {
+        close(fd);
+        return true;
+    }
+
+    // 64 bit FNV-1a
+    guint64 h = 14695981039346656037ULL;
+    vector<unsigned char> buf(fingerprint_chunk_size);
+    off_t offset = start;
+
+    while (offset < end) {
+        ssize_t len = pread(fd, &buf[0], min((off_t) buf.size(), end - offset),
+                            offset);
+        if (len <= 0) {
+            close(fd);
+            return false;
+        }
+
+        for (ssize_t i = 0; i < len; i++) {
+            h ^= buf[i];
+            h *= 1099511628211ULL;
+        }
+
+        offset += len;
+    }
+
+    close(fd);
+
+    fp.hash = h;
+    fp.hashed = true;
+    return true;
+}
+
+FingerprintIndex::FingerprintIndex(FUSEPod *fusepod, const string &file)
+    : fusepod (fusepod), file (file), built (false), building (false),
+      num_duplicates (0) {
+    pthread_mutex_init(&mutex, 0);
+    pthread_mutex_init(&build_mutex, 0);
+
+    ifstream in(file.c_str());
+    string line;
+
+    while (getline(in, line)) {
+        istringstream fields(line);
+        guint64 dbid;
+        gint32 size;
+        Fingerprint fp;
+        int hashed;
+
+        if (fields >> dbid >> size >> fp.length >> hashed >> fp.hash) {
+            fp.hashed = hashed;
+            saved[dbid] = make_pair(size, fp);
+        }
+    }
+}
+
+FingerprintIndex::~FingerprintIndex() {
+    pthread_mutex_destroy(&build_mutex);
+    pthread_mutex_destroy(&mutex);
+}
+
+Itdb_Track *FingerprintIndex::find_duplicate(const string &path,
+                                             Fingerprint &fp) {
+    fp = Fingerprint();
+    if (!fusepod_fingerprint(path, fp, false))
+        return 0;
+
+    build();
+
+    {
+        // Most songs differ in length, in which case no hashing is needed
+        MutexLock lock(mutex);
+        if (by_length.find(fp.length) == by_length.end())
+            return 0;
+    }
+
+    if (!fusepod_fingerprint(path, fp, true))
+        return 0;
+
+    // Tracks of the same length, with the paths to hash them from
+    vector<pair<Itdb_Track*, Entry> > candidates;
+    {
+        MutexLock lock(mutex);
+
+        typedef multimap<off_t, Itdb_Track*>::iterator iterator;
+        pair<iterator, iterator> range = by_length.equal_range(fp.length);
+        for (iterator i = range.first; i != range.second; ++i)
+            candidates.push_back(make_pair(i->second, entries[i->second]));
+    }
+
+    for (size_t i = 0; i < candidates.size(); i++) {
+        Itdb_Track *track = candidates[i].first;
+        Entry &entry = candidates[i].second;
+
+        // Hashing reads the whole song, so mutex isn't held
+        if (!entry.fp.hashed && !hash_entry(entry))
+            continue;
+
+        MutexLock lock(mutex);
+
+        // The track may have gone while it was hashed
+        map<Itdb_Track*, Entry>::iterator e = entries.find(track);
+        if (e == entries.end() || e->second.path != entry.path)
+            continue;
+        e->second.fp = entry.fp;
+
+        if (entry.fp.hash == fp.hash) {
+            num_duplicates++;
+            return track;
+        }
+    }
+
+    return 0;
+}
+
+void FingerprintIndex::add(Itdb_Track *track, const Fingerprint &fp,
+                           const string &real_path) {
+    if (fp.length < 0)
+        return;
+
+    MutexLock lock(mutex);
+
+    remove_locked(track);
+
+    Entry &entry = entries[track];
+    entry.fp = fp;
+    entry.path = real_path;
+    by_length.insert(make_pair(fp.length, track));
+    removed.erase(track);
+}
+
+void FingerprintIndex::remove(Itdb_Track *track) {
+    MutexLock lock(mutex);
+    remove_locked(track);
+}
+
+/**
+ * Removes a track from the index. Called with mutex held.
+ */
+void FingerprintIndex::remove_locked(Itdb_Track *track) {
+    if (building)
+        removed.insert(track);
+
+    map<Itdb_Track*, Entry>::iterator e = entries.find(track);
+    if (e == entries.end())
+        return;
+
+    typedef multimap<off_t, Itdb_Track*>::iterator iterator;
+    pair<iterator, iterator> range = by_length.equal_range(e->second.fp.length);
+    for (iterator i = range.first; i != range.second; ++i) {
+        if (i->second == track) {
+            by_length.erase(i);
+            break;
+        }
+    }
+
+    entries.erase(e);
+}
+
+void FingerprintIndex::save() {
+    ofstream out(file.c_str());
+    if (!out)
+        return;
+
+    MutexLock lock(mutex);
+
+    for (map<Itdb_Track*, Entry>::iterator i = entries.begin();
+         i != entries.end(); ++i) {
+        Itdb_Track *track = i->first;
+        const Fingerprint &fp = i->second.fp;
+
+        if (track->dbid == 0)
+            continue;
+
+        out << track->dbid << ' ' << track->size << ' ' << fp.length << ' '
+            << fp.hashed << ' ' << fp.hash << '\n';
+    }
+
+    // Keep fingerprints of tracks which have not been looked at yet
+    for (map<guint64, pair<gint32, Fingerprint> >::iterator i = saved.begin();
+         i != saved.end(); ++i) {
+        const Fingerprint &fp = i->second.second;
+        out << i->first << ' ' << i->second.first << ' ' << fp.length << ' '
+            << fp.hashed << ' ' << fp.hash << '\n';
+    }
+}
+
+string FingerprintIndex::get_statistics() {
+    MutexLock lock(mutex);
+    ostringstream stats;
+
+    stats << "Fingerprinted Tracks: " << entries.size() << endl
+          << "Duplicates Skipped: " << num_duplicates << endl;
+
+    return stats.str();
+}
+
+/**
+ * Adds every track on the iPod to the index. This only happens the first time
+ * an upload needs the index. The payload lengths come from the saved index
+ * where possible, otherwise each track's tags need to be read.
+ */
+void FingerprintIndex::build() {
+    MutexLock build_lock(build_mutex);
+
+    if (built)
+        return;
+
+    {
+        MutexLock lock(mutex);
+        building = true;
+        removed.clear();
+    }
+
+    vector<pair<Itdb_Track*, Entry> > todo;
+
+    {
+        MutexLock lock(fusepod->mutex);
+
+        for (GList *i = fusepod->ipod->tracks; i; i = i->next) {
+            Itdb_Track *track = (Itdb_Track*) i->data;
+
+            // Also remembers the path, for when the song is opened
+            Entry entry;
+            entry.path = fusepod->get_real_path(track);
+            if (entry.path == "")
+                continue;
+
+            map<guint64, pair<gint32, Fingerprint> >::iterator s =
+                saved.find(track->dbid);
+            if (s != saved.end()) {
+                if (s->second.first == track->size)
+                    entry.fp = s->second.second;
+                saved.erase(s);
+            }
+
+            todo.push_back(make_pair(track, entry));
+        }
+    }
+
+    cout << "Fingerprinting " << todo.size() << " tracks" << endl;
+
+    for (size_t i = 0; i < todo.size(); i++) {
+        Entry &entry = todo[i].second;
+        if (entry.fp.length < 0)
+            fusepod_fingerprint(entry.path, entry.fp, false);
+    }
+
+    MutexLock lock(mutex);
+
+    for (size_t i = 0; i < todo.size(); i++) {
+        Itdb_Track *track = todo[i].first;
+        Entry &entry = todo[i].second;
+
+        if (entry.fp.length < 0 || removed.count(track) ||
+            entries.count(track))
+            continue;
+
+        entries[track] = entry;
+        by_length.insert(make_pair(entry.fp.length, track));
+    }
+
+    removed.clear();
+    building = false;
+    built = true;
+
+    // What is left is of tracks no longer on the iPod
+    saved.clear();
+}
+
+/**
+ * Hashes a copy of the entry of a track already on the iPod. This reads the
+ * whole song, so it is called without mutex held.
+ */
+bool FingerprintIndex::hash_entry(Entry &entry) {
+    Fingerprint fp;
+    if (!fusepod_fingerprint(entry.path, fp, true) ||
+        fp.length != entry.fp.length)
+        return false;
+
+    entry.fp = fp;
+    return true;
+}
@@ -0,0 +1,131 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_fingerprint.h                               *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_FINGERPRINT_H_
+#define _FUSEPOD_FINGERPRINT_H_
+
+#include <gpod/itdb.h>
+
+extern "C" {
+#include <pthread.h>
+#include <sys/types.h>
+}
+
+#include <string>
+#include <map>
+#include <set>
+
+using std::string;
+using std::map;
+using std::multimap;
+using std::set;
+
+class FUSEPod;
+
+/**
+ * Identifies the audio in a file, ignoring any tags. Two files with the same
+ * fingerprint are the same song, even if they have been tagged differently.
+ */
+struct Fingerprint {
+    Fingerprint() : length (-1), hash (0), hashed (false) {}
+    /** Length of the audio payload in bytes. -1 if unknown */
+    off_t length;
+    /** Hash of the audio payload. Only valid if hashed is true */
+    guint64 hash;
+    /** Hashing means reading the whole file, so it is only done if needed */
+    bool hashed;
+};
+
+/**
+ * An index of the fingerprints of every track on the iPod, used to avoid
+ * uploading the same song twice. Fingerprints of tracks already on the iPod
+ * are only worked out when an upload needs them, and are saved next to the
+ * iTunesDB so the next mount does not have to work them out again.
+ */
+class FingerprintIndex {
+  public:
+    /**
+     * @param file Where the fingerprints are saved between mounts.
+     */
+    FingerprintIndex(FUSEPod *fusepod, const string &file);
+    ~FingerprintIndex();
+
+    /**
+     * Looks for a track with the same audio as the file at path. Do not hold
+     * FUSEPod::mutex while calling this, it may read tracks on the iPod.
+     * @param fp Set to the fingerprint of the file, for passing to add.
+     * @return The duplicate track, or the null pointer.
+     */
+    Itdb_Track *find_duplicate(const string &path, Fingerprint &fp);
+
+    /**
+     * Adds a newly uploaded track to the index.
+     * @param real_path Where the track is on the mounted iPod.
+     */
+    void add(Itdb_Track *track, const Fingerprint &fp,
+             const string &real_path);
+
+    /**
+     * Removes a track from the index. Call this before the track is freed.
+     */
+    void remove(Itdb_Track *track);
+
+    /**
+     * Writes the index to disk. Tracks only get a dbid once the iTunesDB has
+     * been written, so call this afterwards. Needs FUSEPod::mutex.
+     */
+    void save();
+
+    /**
+     * @return A multiline string with statistics, in the same format as
+     * FUSEPod::get_statistics.
+     */
+    string get_statistics();
+
+  private:
+    struct Entry {
+        Fingerprint fp;
+        string path;
+    };
+
+    void build();
+    void remove_locked(Itdb_Track *track);
+    static bool hash_entry(Entry &entry);
+
+    FUSEPod *fusepod;
+    string file;
+    bool built;
+    bool building;
+
+    map<Itdb_Track*, Entry> entries;
+    multimap<off_t, Itdb_Track*> by_length;
+    /** Tracks removed while the index was being built */
+    set<Itdb_Track*> removed;
+    /** Fingerprints read from file, by dbid, which still need a track */
+    map<guint64, std::pair<gint32, Fingerprint> > saved;
+
+    pthread_mutex_t mutex;
+    pthread_mutex_t build_mutex;
+
+    unsigned long num_duplicates;
+};
+
+/**
+ * Works out the fingerprint of a file. If hash is false only the payload
+ * length is worked out, which just needs the tag headers to be read.
+ * @return false if the file could not be read.
+ */
+bool fusepod_fingerprint(const string &path, Fingerprint &fp, bool hash);
+
+#endif
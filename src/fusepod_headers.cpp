@@ -0,0 +1,200 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_headers.cpp                                 *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+extern "C" {
+#ifdef linux
+/* For pread() */
+#define _XOPEN_SOURCE 500
+#endif
+
+#include <unistd.h>
+#include <fcntl.h>
+}
+
+#include "fusepod_headers.h"
+#include "fusepod_ipod.h"
+#include "fusepod_util.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+HeaderCache::HeaderCache(size_t header_size, size_t limit)
+    : header_size (header_size), limit (limit), used (0), fusepod (0),
+      warming (false), stopping (false), num_hits (0), num_misses (0) {
+    pthread_mutex_init(&mutex, 0);
+}
+
+HeaderCache::~HeaderCache() {
+    {
+        MutexLock lock(mutex);
+        stopping = true;
+    }
+
+    if (warming)
+        pthread_join(thread, 0);
+
+    pthread_mutex_destroy(&mutex);
+}
+
+bool HeaderCache::contains(guint64 dbid, off_t size) {
+    MutexLock lock(mutex);
+
+    map<guint64, pair<off_t, string> >::iterator h = headers.find(dbid);
+    return h != headers.end() && h->second.first == size;
+}
+
+int HeaderCache::read(guint64 dbid, off_t track_size, int fd, char *buf,
+                      size_t size, off_t offset) {
+    off_t len = min((off_t) header_size, track_size);
+    if (dbid == 0 || offset >= len)
+        return -1;
+
+    size_t wanted = min((off_t) size, track_size - offset);
+    if (offset + (off_t) wanted > len) // Reads past the header
+        return -1;
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        {
+            MutexLock lock(mutex);
+
+            map<guint64, pair<off_t, string> >::iterator h = headers.find(dbid);
+            if (h != headers.end() && h->second.first == track_size) {
+                memcpy(buf, h->second.second.data() + offset, wanted);
+                num_hits++;
+                return wanted;
+            }
+        }
+
+        if (fd == -1 || attempt > 0)
+            break;
+
+        {
+            MutexLock lock(mutex);
+            num_misses++;
+        }
+
+        if (!load(dbid, track_size, fd))
+            break;
+    }
+
+    return -1;
+}
+
+void HeaderCache::warm(FUSEPod *fusepod) {
+    MutexLock lock(mutex);
+
+    if (warming)
+        return;
+
+    this->fusepod = fusepod;
+    warming = !pthread_create(&thread, 0, warm_main, this);
+}
+
+string HeaderCache::get_statistics() {
+    MutexLock lock(mutex);
+    ostringstream stats;
+
+    stats << "Header Cache Hits: " << num_hits << endl
+          << "Header Cache Misses: " << num_misses << endl
+          << "Header Cache Tracks: " << headers.size() << endl
+          << "Header Cache Size: " << used << " of " << limit << endl;
+
+    return stats.str();
+}
+
+void *HeaderCache::warm_main(void *headers) {
+    ((HeaderCache*) headers)->run_warm();
+    return 0;
+}
+
+/**
+ * Reads the header of every song on the iPod. The songs are listed with the
+ * lock held, but read without it so that the filesystem stays usable.
+ */
+void HeaderCache::run_warm() {
+    vector<pair<pair<guint64, off_t>, string> > songs;
+
+    {
+        MutexLock lock(fusepod->mutex);
+        string mount_point = itdb_get_mountpoint(fusepod->ipod);
+
+        for (GList *i = fusepod->ipod->tracks; i; i = i->next) {
+            Track *track = (Track*) i->data;
+            if (track->dbid == 0 || !track->ipod_path)
+                continue;
+
+            gchar *tmp = g_strdup(track->ipod_path);
+            itdb_filename_ipod2fs(tmp);
+            songs.push_back(make_pair(make_pair(track->dbid,
+                                                (off_t) track->size),
+                                      mount_point + tmp));
+            g_free(tmp);
+        }
+    }
+
+    cout << "Reading the headers of " << songs.size() << " tracks" << endl;
+
+    for (size_t i = 0; i < songs.size(); i++) {
+        {
+            MutexLock lock(mutex);
+            if (stopping || used >= limit)
+                break;
+        }
+
+        guint64 dbid = songs[i].first.first;
+        off_t size = songs[i].first.second;
+
+        if (contains(dbid, size))
+            continue;
+
+        int fd = open(songs[i].second.c_str(), O_RDONLY);
+        if (fd == -1)
+            continue;
+
+        load(dbid, size, fd);
+        close(fd);
+    }
+}
+
+/**
+ * Reads the header of a song from fd and keeps it, if there is space.
+ */
+bool HeaderCache::load(guint64 dbid, off_t track_size, int fd) {
+    size_t len = min((off_t) header_size, track_size);
+
+    {
+        MutexLock lock(mutex);
+        if (used + len > limit)
+            return false;
+    }
+
+    string header(len, '\0');
+    if (pread(fd, &header[0], len, 0) != (ssize_t) len)
+        return false;
+
+    MutexLock lock(mutex);
+
+    pair<off_t, string> &h = headers[dbid];
+    used -= h.second.size();
+    h.first = track_size;
+    h.second.swap(header);
+    used += len;
+
+    return true;
+}
@@ -0,0 +1,100 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_headers.h                                   *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_HEADERS_H_
+#define _FUSEPOD_HEADERS_H_
+
+#include <gpod/itdb.h>
+
+extern "C" {
+#include <pthread.h>
+#include <sys/types.h>
+}
+
+#include <string>
+#include <map>
+
+using std::string;
+using std::map;
+
+class FUSEPod;
+
+/**
+ * Keeps the start of songs in memory. Programs which index music read the
+ * tags at the start of every song, and this lets them do so without reading
+ * from the iPod. Songs are identified by their dbid and size.
+ */
+class HeaderCache {
+  public:
+    /**
+     * @param header_size How many bytes to keep of each song.
+     * @param limit The most memory to use in bytes. Once reached, no more
+     * headers are kept.
+     */
+    HeaderCache(size_t header_size, size_t limit);
+
+    /**
+     * Stops warming.
+     */
+    ~HeaderCache();
+
+    /**
+     * @return true if the start of the song is in memory.
+     */
+    bool contains(guint64 dbid, off_t size);
+
+    /**
+     * Reads from the start of a song. If it is not in memory and fd is not
+     * -1, the header is read from fd and kept.
+     * @param track_size The size of the song.
+     * @return The number of bytes read, or -1 if the read can't be served
+     * from the header.
+     */
+    int read(guint64 dbid, off_t track_size, int fd, char *buf, size_t size,
+             off_t offset);
+
+    /**
+     * Reads the headers of every song on the iPod in the background.
+     */
+    void warm(FUSEPod *fusepod);
+
+    /**
+     * @return A multiline string with statistics, in the same format as
+     * FUSEPod::get_statistics.
+     */
+    string get_statistics();
+
+  private:
+    static void *warm_main(void *headers);
+    void run_warm();
+    bool load(guint64 dbid, off_t track_size, int fd);
+
+    size_t header_size;
+    size_t limit;
+    size_t used;
+
+    /** The headers, and the size of the song they are from */
+    map<guint64, std::pair<off_t, string> > headers;
+
+    FUSEPod *fusepod;
+    bool warming;
+    bool stopping;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+
+    unsigned long num_hits;
+    unsigned long num_misses;
+};
+
+#endif
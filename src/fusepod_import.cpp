@@ -0,0 +1,196 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_import.cpp                                  *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_import.h"
+#include "fusepod_ipod.h"
+#include "fusepod_upload.h"
+#include "fusepod_util.h"
+
+#include <iostream>
+#include <sstream>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <glob.h>
+}
+
+using namespace std;
+
+Importer::Importer(FUSEPod *fusepod, int num_workers)
+    : fusepod (fusepod), stopping (false), active (0), num_dirs (0),
+      num_songs (0) {
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&not_empty, 0);
+    pthread_cond_init(&idle, 0);
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, 0, worker_main, this) == 0)
+            workers.push_back(thread);
+    }
+}
+
+Importer::~Importer() {
+    {
+        MutexLock lock(mutex);
+        stopping = true;
+        paths.clear();
+        pthread_cond_broadcast(&not_empty);
+    }
+
+    for (size_t i = 0; i < workers.size(); i++)
+        pthread_join(workers[i], 0);
+
+    pthread_cond_destroy(&idle);
+    pthread_cond_destroy(&not_empty);
+    pthread_mutex_destroy(&mutex);
+}
+
+bool Importer::add(const string &pattern) {
+    if (pattern.empty() || pattern[0] != '/')
+        return false;
+
+    glob_t matches;
+    if (glob(pattern.c_str(), 0, 0, &matches) != 0)
+        return true; // Nothing matched
+
+    MutexLock lock(mutex);
+
+    for (size_t i = 0; i < matches.gl_pathc; i++)
+        paths.push_back(matches.gl_pathv[i]);
+    pthread_cond_broadcast(&not_empty);
+
+    globfree(&matches);
+
+    return true;
+}
+
+void Importer::wait() {
+    MutexLock lock(mutex);
+
+    while ((!paths.empty() || active > 0) && !workers.empty())
+        pthread_cond_wait(&idle, &mutex);
+}
+
+string Importer::get_statistics() {
+    MutexLock lock(mutex);
+    ostringstream stats;
+
+    stats << "Import Pending: " << paths.size() + active << endl
+          << "Import Directories Read: " << num_dirs << endl
+          << "Import Songs Found: " << num_songs << endl;
+
+    return stats.str();
+}
+
+void *Importer::worker_main(void *importer) {
+    ((Importer*) importer)->run();
+    return 0;
+}
+
+void Importer::run() {
+    for (;;) {
+        string path;
+
+        {
+            MutexLock lock(mutex);
+
+            while (paths.empty() && !stopping)
+                pthread_cond_wait(&not_empty, &mutex);
+
+            if (stopping)
+                break;
+
+            // Depth first, so that few directories are waiting at once
+            path = paths.back();
+            paths.pop_back();
+            active++;
+        }
+
+        vector<string> songs;
+        import(path, songs);
+
+        // This blocks while the upload queue is full, holding back the walk
+        for (size_t i = 0; i < songs.size(); i++)
+            fusepod->uploads->push(UploadJob(songs[i]));
+
+        MutexLock lock(mutex);
+        active--;
+        num_songs += songs.size();
+
+        if (paths.empty() && active == 0)
+            pthread_cond_broadcast(&idle);
+    }
+}
+
+/**
+ * Looks at a path. A song is added to songs, and the contents of a
+ * directory are queued for the workers.
+ */
+void Importer::import(const string &path, vector<string> &songs) {
+    struct stat st;
+    if (lstat(path.c_str(), &st))
+        return;
+
+    if (S_ISLNK(st.st_mode) && (stat(path.c_str(), &st) || S_ISDIR(st.st_mode)))
+        return;
+
+    if (S_ISREG(st.st_mode)) {
+        if (FUSEPod::get_filetype(path))
+            songs.push_back(path);
+        return;
+    }
+
+    if (!S_ISDIR(st.st_mode))
+        return;
+
+    DIR *d = opendir(path.c_str());
+    if (!d)
+        return;
+
+    vector<string> dirs;
+    struct dirent *ent;
+
+    while ((ent = readdir(d))) {
+        if (ent->d_name[0] == '.')
+            continue;
+
+        string child = path + "/" + ent->d_name;
+
+#ifdef _DIRENT_HAVE_D_TYPE
+        if (ent->d_type == DT_REG) {
+            if (FUSEPod::get_filetype(child))
+                songs.push_back(child);
+            continue;
+        }
+        if (ent->d_type == DT_DIR) {
+            dirs.push_back(child);
+            continue;
+        }
+#endif
+
+        // Anything else is looked at by a worker
+        dirs.push_back(child);
+    }
+
+    closedir(d);
+
+    MutexLock lock(mutex);
+    num_dirs++;
+    paths.insert(paths.end(), dirs.begin(), dirs.end());
+    if (!dirs.empty())
+        pthread_cond_broadcast(&not_empty);
+}
@@ -0,0 +1,87 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_import.h                                    *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_IMPORT_H_
+#define _FUSEPOD_IMPORT_H_
+
+extern "C" {
+#include <pthread.h>
+}
+
+#include <string>
+#include <deque>
+#include <vector>
+
+using std::string;
+using std::deque;
+using std::vector;
+
+class FUSEPod;
+
+/**
+ * Finds songs in directories and queues them for uploading. Directories are
+ * read by worker threads, which pass the songs they find, going by
+ * FUSEPod::get_filetype, straight to the upload queue. Symbolic links to
+ * directories are not followed.
+ */
+class Importer {
+  public:
+    Importer(FUSEPod *fusepod, int num_workers);
+
+    /**
+     * Stops the workers. Directories which have not been read yet are
+     * forgotten.
+     */
+    ~Importer();
+
+    /**
+     * Imports the songs matching a pattern, which may be a song, a
+     * directory or a glob such as "/music/Deftones*". Directories are
+     * imported recursively. Returns straight away.
+     * @return false if the pattern is not an absolute path.
+     */
+    bool add(const string &pattern);
+
+    /**
+     * Blocks until every directory has been read, and its songs queued.
+     */
+    void wait();
+
+    /**
+     * @return A multiline string with statistics, in the same format as
+     * FUSEPod::get_statistics.
+     */
+    string get_statistics();
+
+  private:
+    static void *worker_main(void *importer);
+    void run();
+    void import(const string &path, vector<string> &songs);
+
+    FUSEPod *fusepod;
+    /** Songs and directories still to be looked at */
+    deque<string> paths;
+    vector<pthread_t> workers;
+    bool stopping;
+    int active;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t idle;
+
+    unsigned long num_dirs;
+    unsigned long num_songs;
+};
+
+#endif
@@ -15,6 +15,22 @@
 #include "fusepod_ipod.h"
 #include "fusepod_util.h"
 #include "fusepod_constants.h"
+#include "fusepod_upload.h"
+#include "fusepod_fingerprint.h"
+#include "fusepod_cache.h"
+#include "fusepod_headers.h"
+#include "fusepod_slots.h"
+#include "fusepod_orphans.h"
+#include "fusepod_commit.h"
+#include "fusepod_journal.h"
+#include "fusepod_import.h"
+#include "fusepod_control.h"
+#include "fusepod_events.h"
+#include "fusepod_search.h"
+#include "fusepod_query.h"
+#include "fusepod_top.h"
+#include "fusepod_config.h"
+#include "fusepod_budget.h"
 
 #include <fileref.h>
 #include <tag.h>
@@ -24,9 +40,13 @@
 #include <sstream>
 #include <cstdlib>
 #include <cstring>
+#include <cctype>
+#include <ctime>
+#include <algorithm>
 
 extern "C" {
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <dirent.h>
@@ -34,11 +54,24 @@ extern "C" {
 
 using namespace std;
 
+size_t Node::count = 0;
+
+/**
+ * @return The first component of a path description if it has no tags in
+ * it, otherwise "".
+ */
+static string literal_root(const string &path_desc) {
+    size_t end = path_desc.find('/', 1);
+    string root = path_desc.substr(1, end == string::npos ? end : end - 1);
+    return root.find('%') == string::npos ? root : "";
+}
+
 Node::~Node() {
     for (iterator i = begin(); i != end(); ++i) {
         delete(*i);
     }
     children.clear();
+    __sync_fetch_and_sub(&count, 1);
 }
 
 Node *Node::find(const NodeValue &nv) {
@@ -80,10 +113,68 @@ void Node::remove_from_parent() {
     }
 }
 
-FUSEPod::FUSEPod(const string &mount_point, vector<string> paths_descs) {
+FUSEPod::FUSEPod(const string &mount_point, vector<string> paths_descs,
+                 const Options &options) {
     this->mount_point = mount_point;
     this->paths_descs = paths_descs;
     this->syncing     = false;
+    this->uploads     = 0;
+    this->orphans     = 0;
+    this->commits     = 0;
+    this->journal     = 0;
+    this->imports     = 0;
+    this->control     = 0;
+    this->config      = 0;
+    this->budget      = 0;
+    this->events      = new EventLog(event_log_size);
+    this->playlist_version_count = 0;
+    this->num_removed = 0;
+    this->search = new SearchIndex();
+    this->table = new TrackTable();
+    this->search_dir = 0;
+    this->query_dir = 0;
+    this->result_stub = new Node(NodeValue("", MODE_DIR));
+
+    int view = atoi(fusepod_get_option(options, "playlist_view", "1").c_str());
+    this->playlist_view = view > 0 && view <= (int) paths_descs.size() ?
+        view - 1 : 0;
+
+    size_t top_size = atoi(fusepod_get_option(
+        options, "top_size", fusepod_int_to_string(default_top_size)).c_str());
+    rankings.push_back(new Ranking(dir_most_played, Ranking::by_playcount,
+                                   top_size));
+    rankings.push_back(new Ranking(dir_top_rated, Ranking::by_rating,
+                                   top_size));
+    rankings.push_back(new Ranking(dir_recently_added,
+                                   Ranking::by_time_added, top_size));
+
+    this->fingerprints = new FingerprintIndex(this,
+                                              mount_point + FINGERPRINTS_PATH);
+    this->cache = 0;
+
+    string cache_dir = fusepod_get_option(options, "cache_dir");
+    if (cache_dir != "") {
+        cache_dir = fusepod_expand_home(cache_dir);
+        cout << "Caching songs in " << cache_dir << endl;
+        this->cache = new TrackCache(cache_dir, fusepod_get_size_option(
+            options, "cache_size", default_cache_size));
+    }
+
+    long long memory_budget = fusepod_get_size_option(options,
+                                                      "memory_budget", 0);
+    if (memory_budget > 0)
+        this->budget = new NodeBudget(memory_budget);
+
+    this->headers = 0;
+
+    long long header_size = fusepod_get_size_option(options, "header_cache", 0);
+    if (header_size > 0)
+        this->headers = new HeaderCache(header_size, fusepod_get_size_option(
+            options, "header_cache_limit", default_header_cache_limit));
+
+    fusepod_init_recursive_mutex(&mutex);
+    pthread_mutex_init(&real_paths_mutex, 0);
+    this->real_paths_forgotten = 0;
 
     char *text = new char[1];
     text[0] = 0;
@@ -97,19 +188,82 @@ FUSEPod::FUSEPod(const string &mount_point, vector<string> paths_descs) {
         itdb_set_mountpoint(ipod, mount_point.c_str());
     }
 
-    add_orphaned_tracks();
+    this->slots = new SlotAllocator(mount_point + "/iPod_Control/Music",
+                                    itdb_musicdirs_number(ipod));
 
     this->num_tracks    = g_list_length (ipod->tracks);
     this->num_playlists = g_list_length (ipod->playlists);
 
     add_playlists();
     add_all_tracks();
+
+    search_dir = root->addChild(
+        NodeValue(fusepod_get_string(dir_search.c_str()), MODE_DIR));
+    query_dir = root->addChild(
+        NodeValue(fusepod_get_string(dir_query.c_str()), MODE_DIR));
+    add_rankings();
+    find_view_roots();
+    enforce_budget();
+
+    uploads = new UploadQueue(this, upload_queue_capacity,
+                              upload_queue_workers);
+
+    journal = new SyncJournal(mount_point + JOURNAL_PATH);
+    journal->resume(this);
+
+    imports = new Importer(this, import_workers);
+
+    orphans = new OrphanScanner(this, mount_point + ORPHAN_SCAN_PATH);
+    orphans->start();
+
+    commits = new DeferredCommit(this);
+
+    if (headers && fusepod_get_option(options, "header_cache_warm") == "yes")
+        headers->warm(this);
+
+    string control_socket = fusepod_get_option(options, "control_socket");
+    if (control_socket != "") {
+        control_socket = fusepod_expand_home(control_socket);
+        control = new ControlServer(this, control_socket);
+        if (control->start()) {
+            cout << "Taking requests on " << control_socket << endl;
+        } else {
+            cout << "Could not make control socket " << control_socket << endl;
+            delete control;
+            control = 0;
+        }
+    }
 }
 
 FUSEPod::~FUSEPod() {
+    events->stop();
+    delete config;
+    delete control;
+    delete imports;
+    journal->stop();
+    orphans->stop();
+    delete uploads; // Finishes uploading queued songs
+    delete commits;
+    commits = 0;
+    delete headers;
+    clear_searches();
+    delete result_stub;
     delete root;
-    itdb_write(ipod, 0);
+    write_db();
+    delete journal;
+    delete orphans;
+    delete fingerprints;
+    delete cache;
+    delete slots;
+    delete search;
+    delete table;
+    delete budget;
+    for (size_t i = 0; i < rankings.size(); i++)
+        delete rankings[i];
+    delete events;
     itdb_free(ipod);
+    pthread_mutex_destroy(&real_paths_mutex);
+    pthread_mutex_destroy(&mutex);
 }
 
 string FUSEPod::discover_ipod() {
@@ -221,46 +375,167 @@ bool FUSEPod::create_itunes_dirs(const string &dir) {
     return true;
 }
 
-Track* FUSEPod::upload_song(const string &path, bool copy) {
-    struct stat st;
+Track* FUSEPod::upload_song(const string &path, bool copy, bool *duplicate) {
+    if (duplicate)
+        *duplicate = false;
+
+    Fingerprint fp;
+    Track *existing = fingerprints->find_duplicate(path, fp);
+    if (existing) {
+        MutexLock lock(mutex);
+
+        // It may have been removed while we were looking
+        if (g_list_find(ipod->tracks, existing)) {
+            if (!copy)
+                unlink(path.c_str());
+            else
+                journal->done(path);
+            if (duplicate)
+                *duplicate = true;
+            return existing;
+        }
+    }
 
-    if (stat(path.c_str(), &st))
+    Track *track = read_song(path);
+    if (!track) {
+        if (copy)
+            journal->done(path);
         return 0;
+    }
 
-    off_t size = st.st_size;
+    if (!copy) { // Move
+        MutexLock lock(mutex);
 
-    Track *track = itdb_track_new();
+        if (!this->move_file(path, track)) {
+            itdb_track_free(track);
+            return 0;
+        }
+
+        add_to_itdb(track);
+        fingerprints->add(track, fp, get_real_path(track));
+        this->num_tracks++;
+        return track;
+    }
+
+    // Copy across. This is slow, so is done without holding the lock. The
+    // track only goes into the iTunesDB once its file is complete.
+    if (!this->copy_file(path, track)) {
+        itdb_track_free(track);
+        return 0;
+    }
+
+    MutexLock lock(mutex);
+
+    add_to_itdb(track);
+    journal->copied(track->ipod_path, path);
+    fingerprints->add(track, fp, get_real_path(track));
+    this->num_tracks++;
+
+    return track;
+}
+
+Track* FUSEPod::adopt_song(const string &path, const string &ipod_path,
+                           const map<char, string> &tags) {
+    {
+        MutexLock lock(mutex);
+        Track *existing = find_by_ipod_path(ipod_path);
+        if (existing)
+            return existing;
+    }
+
+    Track *track = read_song(path);
     if (!track)
         return 0;
 
-    track->size = (gint32) size;
+    track->ipod_path = g_strdup(ipod_path.c_str());
+    track->transferred = TRUE;
 
-    //Set the filetype
-    char types[7][2][5] = { {"wav", "wav"},
-                            {"mp3", "mpeg"},
-                            {"mpeg", "mpeg"},
-                            {"mp4", "mp4"},
-                            {"aac", "mp4"},
-                            {"m4a", "mp4"},
-                            {"m4p", "mp4"} };
+    // Tags from where the song was written win over those in the file
+    for (map<char, string>::const_iterator i = tags.begin(); i != tags.end();
+         ++i)
+        if (i->first != 'e' &&
+            fusepod_check_string(get_track_val(track, i->first)) != i->second)
+            set_track_val(track, i->first, i->second);
 
-    size_t pos = path.rfind('.');
-    if (pos == string::npos) {
+    Fingerprint fp;
+    fusepod_fingerprint(path, fp, false);
+
+    MutexLock lock(mutex);
+
+    // Something else may have added it in the meantime
+    Track *existing = find_by_ipod_path(ipod_path);
+    if (existing) {
         itdb_track_free(track);
-        return 0;
+        return existing;
     }
 
-    track->filetype = 0;
-    string ext = path.substr(pos + 1);
-    for (int i = 0; i < 7; i++) {
-        if (strcasecmp(ext.c_str(), types[i][0]) == 0)
-            track->filetype = g_strdup(types[i][1]);
+    add_to_itdb(track);
+    fingerprints->add(track, fp, path);
+    this->num_tracks++;
+
+    return track;
+}
+
+/**
+ * Finds the track of a file on the iPod. Called with mutex held.
+ */
+Track* FUSEPod::find_by_ipod_path(const string &ipod_path) {
+    for (GList *i = ipod->tracks; i; i = i->next) {
+        Track *track = (Track*) i->data;
+        if (track->ipod_path &&
+            strcasecmp(track->ipod_path, ipod_path.c_str()) == 0)
+            return track;
     }
 
-    if (!track->filetype) {
+    return 0;
+}
+
+const char *FUSEPod::get_filetype(const string &path) {
+    static const char types[7][2][5] = { {"wav", "wav"},
+                                         {"mp3", "mpeg"},
+                                         {"mpeg", "mpeg"},
+                                         {"mp4", "mp4"},
+                                         {"aac", "mp4"},
+                                         {"m4a", "mp4"},
+                                         {"m4p", "mp4"} };
+
+    size_t pos = path.rfind('.');
+    if (pos == string::npos || path.find('/', pos) != string::npos)
+        return 0;
+
+    const char *ext = path.c_str() + pos + 1;
+    for (int i = 0; i < 7; i++)
+        if (strcasecmp(ext, types[i][0]) == 0)
+            return types[i][1];
+
+    return 0;
+}
+
+/**
+ * Creates a track with the tags of the song at path. The track is not added
+ * to the iTunesDB.
+ * @return The null pointer if the song can't be read.
+ */
+Track* FUSEPod::read_song(const string &path) {
+    struct stat st;
+
+    if (stat(path.c_str(), &st))
+        return 0;
+
+    off_t size = st.st_size;
+
+    Track *track = itdb_track_new();
+    if (!track)
+        return 0;
+
+    track->size = (gint32) size;
+
+    const char *filetype = get_filetype(path);
+    if (!filetype) {
         itdb_track_free(track);
         return 0;
     }
+    track->filetype = g_strdup(filetype);
 
     //Get Tags
     TagLib::FileRef f(path.c_str());
@@ -288,6 +563,18 @@ Track* FUSEPod::upload_song(const string &path, bool copy) {
       track->tracklen   = (gint32) props->length() * 1000;
     }
 
+    return track;
+}
+
+/**
+ * Adds a track to the iTunesDB and the master playlist. Called with mutex
+ * held.
+ */
+void FUSEPod::add_to_itdb(Track *track) {
+    // Recently Added is ordered by this
+    if (!track->time_added)
+        track->time_added = time(0);
+
     // Add to iTunesDB
     itdb_track_add(this->ipod, track, -1);
 
@@ -299,55 +586,35 @@ Track* FUSEPod::upload_song(const string &path, bool copy) {
         itdb_playlist_set_mpl(mpl);
     }
     itdb_playlist_add_track(mpl, track, -1);
+}
 
-    if (copy) {
-        // Copy across
-        gchar *tmp = g_strdup(path.c_str());
-        if (!itdb_cp_track_to_ipod(track, tmp, 0)) {
-            g_free(tmp);
-            itdb_track_free(track);
-            return 0;
-        }
-        g_free(tmp);
-    }
-    else if (!this->move_file(path, track)) { // Move
-        itdb_track_free(track);
-        return 0;
-    }
-
-    this->num_tracks++;
+bool FUSEPod::remove_song(const string &path) {
+    Node *node = this->get_node(path.c_str());
+    if (!node || !S_ISREG(node->value.mode) || !node->value.track)
+        return false;
 
-    return track;
+    return remove_song(node->value.track);
 }
 
-bool FUSEPod::remove_song(const string &path) {
-    string real_path = this->get_real_path(path);
+bool FUSEPod::remove_song(Track *track) {
+    string real_path = this->get_real_path(track);
 
     if (real_path != "" && unlink(real_path.c_str())) //removes if file exists
         return false;
 
-    Track *track = this->get_node(path.c_str())->value.track;
-
-    for (size_t i = 0; i < paths_descs.size (); i++)
-        remove_track(track, paths_descs[i]);
+    fingerprints->remove(track);
 
-    /* TODO There has to be a better way than this to remove the track from
-     * the playlists in fusepod. */
-    Node *pnode = get_node(dir_playlists.c_str ());
-    for (Node::iterator p = pnode->begin(); p != pnode->end(); ++p) {
-        for (Node::iterator t = (*p)->begin(); t != (*p)->end(); ++t) {
-            if ((*t)->value.track == track) {
-                (*p)->children.erase(t);
-                delete *t;
-            }
-        }
-    }
+    remove_track(track);
 
     // Remove from playlists
     for (GList *i = ipod->playlists; i; i = i->next)
         itdb_playlist_remove_track((Playlist*) i->data, track);
 
+    slots->release(track->ipod_path);
+
+    forget_real_path(track);
     itdb_track_remove(track);
+    num_removed++;
 
     this->num_tracks--;
 
@@ -371,63 +638,209 @@ void FUSEPod::remove_playlist(const string &name) {
         node->parent->children.erase(node);
         delete node;
 
+        Node *file = this->get_node(
+            (dir_playlists + "/" + name + playlist_file_ext).c_str());
+        if (file) {
+            file->remove_from_parent();
+            delete file;
+        }
+
+        playlist_versions.erase(playlist);
         itdb_playlist_remove(playlist);
 
         this->num_playlists--;
+        events->post("changed");
 
         break;
     }
 }
 
+Playlist *FUSEPod::find_playlist(const string &name) {
+    for (GList *i = this->ipod->playlists; i; i = i->next) {
+        Playlist *playlist = (Playlist*) i->data;
+
+        if (!itdb_playlist_is_mpl(playlist) &&
+            fusepod_check_string(playlist->name) == name)
+            return playlist;
+    }
+
+    return 0;
+}
+
+Playlist *FUSEPod::create_playlist(const string &name) {
+    if (name.empty() || name.find('/') != string::npos || find_playlist(name))
+        return 0;
+
+    Playlist *playlist = itdb_playlist_new(name.c_str(), FALSE);
+    itdb_playlist_add(this->ipod, playlist, -1);
+    this->num_playlists++;
+
+    refresh_playlist(playlist);
+
+    return playlist;
+}
+
+bool FUSEPod::add_to_playlist(Playlist *playlist, Track *track, int pos) {
+    if (pos < 0 || pos > playlist->num + 1)
+        return false;
+
+    itdb_playlist_add_track(playlist, track, pos - 1);
+    refresh_playlist(playlist);
+
+    return true;
+}
+
+bool FUSEPod::remove_from_playlist(Playlist *playlist, int pos) {
+    GList *link = g_list_nth(playlist->members, pos - 1);
+    if (pos < 1 || !link)
+        return false;
+
+    playlist->members = g_list_delete_link(playlist->members, link);
+    playlist->num--;
+    refresh_playlist(playlist);
+
+    return true;
+}
+
+bool FUSEPod::move_in_playlist(Playlist *playlist, int from, int to) {
+    GList *link = g_list_nth(playlist->members, from - 1);
+    if (from < 1 || to < 1 || to > playlist->num || !link)
+        return false;
+
+    gpointer track = link->data;
+    playlist->members = g_list_delete_link(playlist->members, link);
+    playlist->members = g_list_insert(playlist->members, track, to - 1);
+    refresh_playlist(playlist);
+
+    return true;
+}
+
 bool FUSEPod::flush() {
+    MutexLock lock(mutex);
+
     if (this->syncing)
         return false;
 
     this->syncing = true;
 
-    if (!itdb_write(this->ipod, 0)) {
+    if (!write_db()) {
         this->syncing = false;
         return false;
     }
 
     add_playlists();
     add_all_tracks();
+    events->post("changed");
 
     this->syncing = false;
 
     return true;
 }
 
-Node *FUSEPod::get_node(const char *path) {
+bool FUSEPod::write_db() {
+    if (!itdb_write(this->ipod, 0)) {
+        events->post("error", "Could not write the iTunesDB");
+        return false;
+    }
+
+    fingerprints->save();
+    orphans->save();
+    if (journal)
+        journal->committed();
+    if (commits)
+        commits->written();
+
+    // Searches are made again, with the songs added since
+    clear_searches();
+
+    events->post("commit");
+
+    return true;
+}
+
+Node *FUSEPod::get_node(const char *path, bool make) {
     Node *cur = root;
     char *tmp = strdup (path);
     vector<char*> paths = fusepod_split_path(tmp, '/');
     NodeValue node(0);
+    bool restored = false;
 
     for (size_t i = 0; i < paths.size () && cur; i++) {
         node.text = paths[i];
-        cur = cur->find(node);
+        Node *next = cur->find(node);
+        bool looked_in = make || i + 1 < paths.size();
+        if (!next && cur == search_dir && search_dir)
+            next = looked_in ? add_search(paths[i]) : result_stub;
+        else if (!next && cur == query_dir && query_dir && looked_in)
+            next = add_query(paths[i]);
+        else if (!next && cur == query_dir && query_dir &&
+                 table->is_valid(paths[i]))
+            next = result_stub;
+
+        if (next && budget) {
+            if (i == 1 && is_view_root(cur))
+                budget->touch(next);
+            if (budget->is_evicted(next)) {
+                restore_dir(next);
+                restored = true;
+            }
+        }
+
+        cur = next;
     }
 
     free (tmp);
+
+    // The directories just walked through have been touched, so stay
+    if (restored)
+        enforce_budget();
+
     return cur;
 }
 
 string FUSEPod::get_real_path(const NodeValue &nv) {
-    if (!S_ISREG(nv.mode))
+    if (!S_ISREG(nv.mode) || !nv.track)
         return "";
 
-    gchar *tmp = itdb_filename_on_ipod(nv.track);
+    return this->get_real_path(nv.track);
+}
+
+string FUSEPod::get_real_path(Track *track) {
+    unsigned long forgotten;
+    {
+        MutexLock lock(real_paths_mutex);
+        map<Track*, string>::iterator i = real_paths.find(track);
+        if (i != real_paths.end())
+            return i->second;
+        forgotten = real_paths_forgotten;
+    }
+
+    // Reads the iPod's directories, so real_paths_mutex isn't held
+    gchar *tmp = itdb_filename_on_ipod(track);
     if (!tmp)
-        return "";
+        return ""; // Not remembered, since it may be being copied
 
     string real_path = string(tmp);
     g_free(tmp);
 
+    MutexLock lock(real_paths_mutex);
+    if (forgotten == real_paths_forgotten)
+        real_paths[track] = real_path;
+
     return real_path;
 }
 
+/**
+ * Forgets the real path of a track, before it moves or is freed.
+ */
+void FUSEPod::forget_real_path(Track *track) {
+    MutexLock lock(real_paths_mutex);
+    real_paths.erase(track);
+    real_paths_forgotten++;
+}
+
 string FUSEPod::get_real_path(const string &path) {
+    MutexLock lock(mutex);
     Node *node = this->get_node(path.c_str());
     if (node)
         return this->get_real_path(node->value);
@@ -458,12 +871,106 @@ string FUSEPod::get_statistics () {
         count--;
     stats << "Playlist Count: " << count << endl;
 
+    if (uploads)
+        stats << uploads->get_statistics();
+    stats << fingerprints->get_statistics();
+    if (cache)
+        stats << cache->get_statistics();
+    if (headers)
+        stats << headers->get_statistics();
+    if (orphans)
+        stats << orphans->get_statistics();
+    if (commits)
+        stats << commits->get_statistics();
+    if (journal)
+        stats << journal->get_statistics();
+    if (imports)
+        stats << imports->get_statistics();
+    if (control)
+        stats << control->get_statistics();
+    if (config)
+        stats << config->get_statistics();
+    if (budget)
+        stats << budget->get_statistics();
+    stats << events->get_statistics();
+    stats << search->get_statistics();
+    stats << table->get_statistics();
+
     return stats.str();
 }
 
 void FUSEPod::add_track(Track *track) {
     for (unsigned int a = 0; a < paths_descs.size(); a++)
         add_track(track, paths_descs[a]);
+
+    search->add(track);
+    table->add(track);
+
+    for (size_t i = 0; i < rankings.size(); i++)
+        if (rankings[i]->add(track))
+            refresh_ranking(i);
+
+    enforce_budget();
+
+    events->post("changed");
+
+    Node *pnode = root->find(dir_playlists.c_str());
+    if (!pnode)
+        return;
+
+    for (GList *i = this->ipod->playlists; i; i = i->next) {
+        Playlist *playlist = (Playlist*) i->data;
+
+        if (itdb_playlist_is_mpl(playlist))
+            continue;
+
+        Node *node = pnode->find(
+            fusepod_check_string(playlist->name).c_str());
+        if (!node)
+            continue;
+
+        int pos = 1;
+        for (GList *a = playlist->members; a; a = a->next, pos++) {
+            if ((Track*) a->data == track) {
+                node->addChild(playlist_entry(playlist, pos, track));
+                playlist_changed(playlist);
+            }
+        }
+    }
+}
+
+void FUSEPod::remove_track(Track *track) {
+    for (size_t i = 0; i < paths_descs.size(); i++)
+        remove_track(track, paths_descs[i]);
+
+    search->remove(track);
+    table->remove(track);
+    forget_results(track);
+
+    for (size_t i = 0; i < rankings.size(); i++)
+        if (rankings[i]->remove(track))
+            refresh_ranking(i);
+
+    events->post("changed");
+
+    for (GList *i = this->ipod->playlists; i; i = i->next)
+        if (g_list_find(((Playlist*) i->data)->members, track))
+            playlist_changed((Playlist*) i->data);
+
+    Node *pnode = root->find(dir_playlists.c_str());
+    if (!pnode)
+        return;
+
+    for (Node::iterator p = pnode->begin(); p != pnode->end(); ++p) {
+        Node::iterator t = (*p)->begin();
+        while (t != (*p)->end()) {
+            Node *node = *t++;
+            if (node->value.track == track) {
+                (*p)->children.erase(node);
+                delete node;
+            }
+        }
+    }
 }
 
 string FUSEPod::get_track_val(Track *track, char symbol) {
@@ -519,46 +1026,231 @@ string FUSEPod::get_track_val(Track *track, char symbol) {
     return val;
 }
 
-string FUSEPod::expand_string(Track *track, const string &format) {
-    string ret = "";
-
-    char * tmp = strdup(format.c_str());
-    vector<char*> tokens = fusepod_split_path(tmp, '%');
-
-    if (tmp == tokens[0])
-        ret += tokens[0];
-    else
-        ret += fusepod_check_string(get_track_val(track, tokens[0][0])) +
-            (&tokens[0][1]);
+/**
+ * Sets the tag of a track which get_track_val returns for symbol.
+ */
+void FUSEPod::set_track_val(Track *track, char symbol, const string &val) {
+    gchar *text = val == "Unknown" ? 0 : g_strdup(val.c_str());
+    gchar **field = 0;
 
-    for (size_t a = 1; a < tokens.size(); a++) {
-        ret += fusepod_check_string(get_track_val(track, tokens[a][0])) +
-            (&tokens[a][1]);
+    switch (symbol) {
+        case 'c': // Artist without compilations
+            track->compilation = val == "Compilations";
+            if (track->compilation)
+                break;
+            // Fall through
+        case 'a': // Artist
+            field = &track->artist;
+            break;
+        case 'A': // Album
+            field = &track->album;
+            break;
+        case 't': // Title
+            if (track->compilation && track->artist &&
+                val.find(string(track->artist) + " - ") == 0) {
+                g_free(text);
+                text = g_strdup(val.substr(strlen(track->artist) + 3).c_str());
+            }
+            field = &track->title;
+            break;
+        case 'g': // Genre
+            field = &track->genre;
+            break;
+        case 'T': // Track
+            track->track_nr = atoi(val.c_str());
+            break;
+        case 'y': // Year
+            track->year = atoi(val.c_str());
+            break;
+        case 'r': // Rating
+            track->rating = atoi(val.c_str()) * ITDB_RATING_STEP;
+            break;
     }
 
-    free(tmp);
-
-    return ret;
+    if (field) {
+        g_free(*field);
+        *field = text;
+    } else
+        g_free(text);
 }
 
-void FUSEPod::add_track(Track *track, const string &path_desc) {
-    char *tmp = strdup(path_desc.c_str());
-    vector<char*> paths = fusepod_split_path(tmp, '/');
-    Node *node = root;
+/**
+ * Matches name against one component of a path description, eg
+ * "%T - %t.%e". Symbols match as little as they can, so that the rest of the
+ * component can match. Numbers only match digits, and extensions can't
+ * contain a '.'.
+ */
+static bool match_component(const char *format, const char *name,
+                            map<char, string> &tags) {
+    if (*format == 0)
+        return *name == 0;
 
-    for (size_t i = 0; i < paths.size(); i++) {
-        string path = expand_string(track, paths[i]);
+    if (*format != '%' || format[1] == 0)
+        return *format == *name && match_component(format + 1, name + 1, tags);
 
-        NodeValue nv(
-            fusepod_get_string(fusepod_check_string(path.c_str()).c_str()),
-            MODE_DIR);
-        if (i == paths.size() - 1) {
-            nv.mode = MODE_FILE;
-            nv.track = track;
-            nv.size = track->size;
-        }
+    char symbol = format[1];
+    size_t len = strlen(name);
+
+    for (size_t n = 1; n <= len; n++) {
+        char c = name[n - 1];
+        if (strchr("Tyr", symbol) && !isdigit(c))
+            break;
+        if (symbol == 'e' && c == '.')
+            break;
+
+        string val(name, n);
+        map<char, string>::iterator i = tags.find(symbol);
+        bool seen = i != tags.end();
+
+        // A symbol used twice must have the same value both times
+        if (seen && i->second != val)
+            continue;
+
+        tags[symbol] = val;
+        if (match_component(format + 2, name + n, tags))
+            return true;
+        if (!seen)
+            tags.erase(symbol);
+    }
+
+    return false;
+}
+
+bool FUSEPod::match_path(const string &path, map<char, string> &tags) {
+    char *tmp = strdup(path.c_str());
+    vector<char*> names = fusepod_split_path(tmp, '/');
+    bool matched = false;
+
+    for (size_t a = 0; a < paths_descs.size() && !matched; a++) {
+        char *desc = strdup(paths_descs[a].c_str());
+        vector<char*> formats = fusepod_split_path(desc, '/');
+
+        if (formats.size() == names.size()) {
+            tags.clear();
+            matched = true;
+            for (size_t i = 0; i < names.size() && matched; i++)
+                matched = match_component(formats[i], names[i], tags);
+        }
+
+        free(desc);
+    }
+
+    free(tmp);
+
+    return matched;
+}
+
+bool FUSEPod::in_view(const string &path) {
+    char *tmp = strdup(path.c_str());
+    vector<char*> names = fusepod_split_path(tmp, '/');
+    bool found = false;
+
+    for (size_t a = 0; a < paths_descs.size() && !found && names.size() > 1;
+         a++) {
+        char *desc = strdup(paths_descs[a].c_str());
+        vector<char*> formats = fusepod_split_path(desc, '/');
+        map<char, string> tags;
+
+        // Only the directories of a view can be written to
+        found = formats.size() > 1 && names.size() <= formats.size() &&
+            match_component(formats[0], names[0], tags);
+
+        free(desc);
+    }
+
+    free(tmp);
+
+    return found;
+}
+
+bool FUSEPod::can_retag(Track *track, const map<char, string> &tags) {
+    for (map<char, string>::const_iterator i = tags.begin(); i != tags.end();
+         ++i) {
+        if (fusepod_check_string(get_track_val(track, i->first)) == i->second)
+            continue;
+
+        // The file itself is not changed, so neither can its format be
+        if (i->first == 'e')
+            return false;
+        if (i->first == 'r' && atoi(i->second.c_str()) > 5)
+            return false;
+    }
+
+    return true;
+}
+
+bool FUSEPod::retag_track(Track *track, const map<char, string> &tags) {
+    if (!can_retag(track, tags))
+        return false;
+
+    map<char, string> changed;
+
+    for (map<char, string>::const_iterator i = tags.begin(); i != tags.end();
+         ++i)
+        if (fusepod_check_string(get_track_val(track, i->first)) != i->second)
+            changed.insert(*i);
+
+    if (changed.empty())
+        return true;
+
+    remove_track(track);
+
+    for (map<char, string>::iterator i = changed.begin(); i != changed.end();
+         ++i)
+        set_track_val(track, i->first, i->second);
+    track->time_modified = time(0);
+
+    add_track(track);
+    commits->schedule();
+
+    return true;
+}
+
+string FUSEPod::expand_string(Track *track, const string &format) {
+    string ret = "";
+
+    char * tmp = strdup(format.c_str());
+    vector<char*> tokens = fusepod_split_path(tmp, '%');
+
+    if (tmp == tokens[0])
+        ret += tokens[0];
+    else
+        ret += fusepod_check_string(get_track_val(track, tokens[0][0])) +
+            (&tokens[0][1]);
+
+    for (size_t a = 1; a < tokens.size(); a++) {
+        ret += fusepod_check_string(get_track_val(track, tokens[a][0])) +
+            (&tokens[a][1]);
+    }
+
+    free(tmp);
+
+    return ret;
+}
+
+void FUSEPod::add_track(Track *track, const string &path_desc) {
+    char *tmp = strdup(path_desc.c_str());
+    vector<char*> paths = fusepod_split_path(tmp, '/');
+    Node *node = root;
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        string path = expand_string(track, paths[i]);
+
+        NodeValue nv(
+            fusepod_get_string(fusepod_check_string(path.c_str()).c_str()),
+            MODE_DIR);
+        if (i == paths.size() - 1) {
+            nv.mode = MODE_FILE;
+            nv.track = track;
+            nv.size = track->size;
+        }
 
         Node *n = node->find(nv);
+        if (n && budget && budget->is_evicted(n)) {
+            // Added when the directory is rebuilt
+            budget->add(n, track);
+            break;
+        }
         if (n == 0)
             n = node->addChild(nv);
         node = n;
@@ -580,6 +1272,8 @@ void FUSEPod::remove_track(Track *track, const string &path_desc) {
         Node *n = node->find(nv);
         if (n == 0)
             break;
+        if (budget && budget->is_evicted(n))
+            restore_dir(n);
         node = n;
     }
 
@@ -616,160 +1310,842 @@ void FUSEPod::add_playlists() {
         if (node == 0)
             node = pnode->find(nv);
 
-        size_t pos_len = 1;
-        int tmp = playlist->num;
-        while ((tmp /= 10) > 0) //For padding track number with 0's
-            pos_len++;
+        int pos = 1;
+        for (GList *a = playlist->members; a; a = a->next)
+            node->addChild(playlist_entry(playlist, pos++, (Track*) a->data));
 
-        tmp = 1;
-        for (GList *a = playlist->members; a; a = a->next) {
-            Track *track = (Track*) a->data;
+        add_playlist_file(pnode, playlist);
+        playlist_changed(playlist);
+    }
+}
 
-            string pos = fusepod_int_to_string((int) tmp++);
-            while (pos.length() < pos_len)
-                pos = "0" + pos;
+/**
+ * Adds the M3U file of a playlist next to its directory. Its content is
+ * made when it is read.
+ */
+void FUSEPod::add_playlist_file(Node *pnode, Playlist *playlist) {
+    string name = fusepod_check_string(playlist->name) + playlist_file_ext;
+    pnode->addChild(NodeValue(fusepod_get_string(name.c_str()), MODE_FILE));
+}
 
-            string filename = pos + " - " + fusepod_check_string(
-                expand_string(track, playlist_track_format));
+void FUSEPod::playlist_changed(Playlist *playlist) {
+    playlist_versions[playlist] = ++playlist_version_count;
+}
 
-            node->addChild(NodeValue(fusepod_get_string(filename.c_str()),
-                                     MODE_FILE, track, track->size));
-        }
-    }
+unsigned long FUSEPod::get_playlist_version(Playlist *playlist) {
+    map<Playlist*, unsigned long>::iterator i =
+        playlist_versions.find(playlist);
+    return i == playlist_versions.end() ? 0 : i->second;
+}
+
+string FUSEPod::get_view_path(Track *track) {
+    return get_view_path(track, playlist_view);
+}
+
+string FUSEPod::get_view_path(Track *track, size_t view) {
+    if (view >= paths_descs.size())
+        return "";
+
+    char *tmp = strdup(paths_descs[view].c_str());
+    vector<char*> paths = fusepod_split_path(tmp, '/');
+    string path;
+
+    // The same as the names add_track gives the nodes
+    for (size_t i = 0; i < paths.size(); i++)
+        path += "/" + fusepod_check_string(expand_string(track, paths[i]));
+
+    free(tmp);
+
+    return path;
+}
+
+/**
+ * Returns the node value of the track at position pos of a playlist. The
+ * positions are padded with 0's so they sort in order.
+ */
+NodeValue FUSEPod::playlist_entry(Playlist *playlist, int pos, Track *track) {
+    return numbered_entry(pos, playlist->num, track);
+}
+
+/**
+ * Returns the node value of a track numbered pos out of count, eg
+ * "07 - Deftones - Change.mp3".
+ */
+NodeValue FUSEPod::numbered_entry(int pos, int count, Track *track) {
+    size_t pos_len = 1;
+    int tmp = count;
+    while ((tmp /= 10) > 0)
+        pos_len++;
+
+    string spos = fusepod_int_to_string(pos);
+    while (spos.length() < pos_len)
+        spos = "0" + spos;
+
+    string filename = spos + " - " + fusepod_check_string(
+        expand_string(track, playlist_track_format));
+
+    return NodeValue(fusepod_get_string(filename.c_str()), MODE_FILE, track,
+                     track->size);
+}
+
+/**
+ * Makes the directory of a playlist list its tracks again, eg after they
+ * have been reordered.
+ */
+void FUSEPod::refresh_playlist(Playlist *playlist) {
+    Node *pnode = root->find(dir_playlists.c_str());
+    if (!pnode)
+        return;
+
+    NodeValue nv(fusepod_get_string(
+        fusepod_check_string(playlist->name).c_str()), MODE_DIR);
+    Node *node = pnode->find(nv);
+    if (!node)
+        node = pnode->addChild(nv);
+
+    for (Node::iterator i = node->begin(); i != node->end(); ++i)
+        delete *i;
+    node->children.clear();
+
+    int pos = 1;
+    for (GList *a = playlist->members; a; a = a->next)
+        node->addChild(playlist_entry(playlist, pos++, (Track*) a->data));
+
+    add_playlist_file(pnode, playlist);
+    playlist_changed(playlist);
+    events->post("changed");
 }
 
 void FUSEPod::add_all_tracks() {
+    vector<size_t> serial;
+    ViewBuild *build = start_build(serial);
+
+    // The other views are built by the workers in the meantime
     for (GList *i = this->ipod->tracks; i; i = i->next) {
         Track *track = (Track*) i->data;
 
-        for (unsigned int a = 0; a < paths_descs.size(); a++)
-            add_track(track, paths_descs[a]);
+        for (size_t a = 0; a < serial.size(); a++)
+            add_track(track, paths_descs[serial[a]]);
+
+        search->add(track);
+        table->add(track);
+
+        for (size_t r = 0; r < rankings.size(); r++)
+            rankings[r]->add(track);
     }
+
+    if (build)
+        finish_build(build);
+
+    clear_searches();
 }
 
 /**
- * Adds all files that are not in the itdb but are in the music dir
+ * A view, or the part of one whose top directories hash to part, built
+ * by a worker into a directory of its own.
  */
-void FUSEPod::add_orphaned_tracks() {
-    // TODO FIX THIS CODE
-    if (true)
-        return;
-    set<string> files_in_itdb;
+struct ViewPart {
+    size_t view;
+    unsigned part;
+    Node *top;
+    StringPool strings;
+};
+
+/**
+ * Building the views when mounting. Views with a top directory of their
+ * own are split into parts, which workers build apart from the tree. The
+ * parts are then moved into the tree.
+ */
+struct ViewBuild {
+    vector<Track*> tracks;
+    /** The path descriptions built by the workers */
+    vector<size_t> views;
+    /** The part each track is in, for each of views */
+    vector<vector<unsigned char> > parts;
+    unsigned num_parts;
+    size_t chunk_size;
+    size_t chunks;
+
+    vector<ViewPart*> units;
+
+    FUSEPod *fusepod;
+    bool partitioning;
+    size_t next;
+    size_t jobs;
+    pthread_mutex_t mutex;
+    vector<pthread_t> threads;
+};
+
+/**
+ * Hashes the name of a node ignoring case, since names which only differ
+ * in case are the same node.
+ */
+static unsigned hash_name(const string &name) {
+    unsigned hash = 5381;
+    for (size_t i = 0; i < name.size(); i++)
+        hash = hash * 33 + (unsigned char) tolower(name[i]);
+    return hash;
+}
+
+/**
+ * Starts building the views which can be built in parallel.
+ * @param serial Set to the views which have to be built as before.
+ * @return The null pointer if every view is built as before.
+ */
+ViewBuild *FUSEPod::start_build(vector<size_t> &serial) {
+    vector<size_t> views;
+    bool parallel = true;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned workers = cpus > 1 ? (unsigned) cpus : 1;
+    if (workers > view_build_max_workers)
+        workers = view_build_max_workers;
+
+    size_t num_tracks = g_list_length(ipod->tracks);
+    if (workers < 2 || num_tracks < view_build_min_tracks)
+        parallel = false;
+
+    // A view whose top directory comes from tags could share a directory
+    // with any other view
+    for (size_t i = 0; i < paths_descs.size() && parallel; i++)
+        if (literal_root(paths_descs[i]) == "")
+            parallel = false;
+
+    for (size_t i = 0; i < paths_descs.size(); i++) {
+        string name = literal_root(paths_descs[i]);
+        bool own = parallel && !is_reserved(name) && !root->find(name.c_str())
+            && count(paths_descs[i].begin(), paths_descs[i].end(), '/') >= 2;
+
+        for (size_t j = 0; j < paths_descs.size() && own; j++)
+            own = j == i || literal_root(paths_descs[j]) != name;
+
+        if (own)
+            views.push_back(i);
+        else
+            serial.push_back(i);
+    }
+
+    if (views.empty())
+        return 0;
+
+    ViewBuild *build = new ViewBuild();
+    build->fusepod = this;
+    build->views = views;
+    build->num_parts = workers;
+    for (GList *i = ipod->tracks; i; i = i->next)
+        build->tracks.push_back((Track*) i->data);
+
+    build->parts.resize(views.size());
+    for (size_t v = 0; v < views.size(); v++)
+        build->parts[v].resize(num_tracks);
+
+    build->chunks = workers * 4;
+    build->chunk_size = (num_tracks + build->chunks - 1) / build->chunks;
+
+    for (size_t v = 0; v < views.size(); v++) {
+        for (unsigned p = 0; p < workers; p++) {
+            ViewPart *part = new ViewPart();
+            part->view = views[v];
+            part->part = p;
+            part->top = new Node(NodeValue("", MODE_DIR));
+            build->units.push_back(part);
+        }
+    }
+
+    fusepod_init_recursive_mutex(&build->mutex);
 
-    // Iterate through all the tracks in the iTunesDB. Add these to files_in_itdb
-    for (GList * i=ipod->tracks; i; i=i->next) {
-        Track * track = (Track*) i->data;
+    cout << "Building " << views.size() << " views with " << workers
+         << " threads" << endl;
 
-        if (track->ipod_path) {
-            gchar * str = strdup (track->ipod_path);
-            int pos = strlen (str);
-            int count = 0;
+    // Find which part each track is in first, so the parts are disjoint
+    build->partitioning = true;
+    run_workers(build, views.size() * build->chunks);
+    join_workers(build);
 
-            for (; pos >= 0 && count < 2; pos--)
-                if (str[pos] == ':') {
-                    count++;
-                    str [pos] = '/';
-                }
+    build->partitioning = false;
+    run_workers(build, build->units.size());
 
-            pos++;
+    return build;
+}
+
+/**
+ * Waits for the workers, and moves the parts they built into the tree.
+ */
+void FUSEPod::finish_build(ViewBuild *build) {
+    join_workers(build);
 
-            string s = &(str[pos]);
-            free (str);
+    for (size_t v = 0; v < build->views.size(); v++) {
+        string name = literal_root(paths_descs[build->views[v]]);
+        Node *top = root->addChild(
+            NodeValue(fusepod_get_string(name.c_str()), MODE_DIR));
 
-            if (count != 2)
+        for (size_t u = 0; u < build->units.size(); u++) {
+            ViewPart *part = build->units[u];
+            if (part->view != build->views[v])
                 continue;
 
-            files_in_itdb.insert (s);
+            for (Node::iterator i = part->top->begin();
+                 i != part->top->end(); ++i) {
+                (*i)->parent = top;
+                top->children.insert(*i);
+                if ((*i)->value.mode == MODE_DIR)
+                    top->value.size++;
+            }
+            part->top->children.clear();
+        }
+    }
+
+    for (size_t u = 0; u < build->units.size(); u++) {
+        build->units[u]->strings.merge();
+        delete build->units[u]->top;
+        delete build->units[u];
+    }
+
+    pthread_mutex_destroy(&build->mutex);
+    delete build;
+}
+
+void FUSEPod::run_workers(ViewBuild *build, size_t jobs) {
+    build->next = 0;
+    build->jobs = jobs;
+
+    for (unsigned i = 0; i < build->num_parts; i++) {
+        pthread_t thread;
+        if (!pthread_create(&thread, 0, build_main, build))
+            build->threads.push_back(thread);
+    }
+
+    // Without threads the work is done here
+    if (build->threads.empty())
+        build_main(build);
+}
+
+void FUSEPod::join_workers(ViewBuild *build) {
+    for (size_t i = 0; i < build->threads.size(); i++)
+        pthread_join(build->threads[i], 0);
+    build->threads.clear();
+}
+
+void *FUSEPod::build_main(void *arg) {
+    ViewBuild *build = (ViewBuild*) arg;
+
+    for (;;) {
+        size_t job;
+        {
+            MutexLock lock(build->mutex);
+            if (build->next >= build->jobs)
+                return 0;
+            job = build->next++;
+        }
+
+        if (build->partitioning)
+            build->fusepod->partition_tracks(build, job);
+        else
+            build->fusepod->build_part(build, build->units[job]);
+    }
+}
+
+/**
+ * Finds the part of a chunk of tracks in a view, from the name of the
+ * directory or file they have in its top directory.
+ */
+void FUSEPod::partition_tracks(ViewBuild *build, size_t job) {
+    size_t v = job / build->chunks;
+    size_t first = (job % build->chunks) * build->chunk_size;
+    size_t last = min(first + build->chunk_size, build->tracks.size());
+
+    char *tmp = strdup(paths_descs[build->views[v]].c_str());
+    vector<char*> paths = fusepod_split_path(tmp, '/');
+
+    for (size_t t = first; t < last; t++) {
+        string name = fusepod_check_string(
+            expand_string(build->tracks[t], paths[1]));
+        build->parts[v][t] = hash_name(name) % build->num_parts;
+    }
+
+    free(tmp);
+}
+
+/**
+ * Builds a part of a view into its own top directory, like add_track does.
+ */
+void FUSEPod::build_part(ViewBuild *build, ViewPart *part) {
+    size_t v = find(build->views.begin(), build->views.end(), part->view) -
+        build->views.begin();
+
+    char *tmp = strdup(paths_descs[part->view].c_str());
+    vector<char*> paths = fusepod_split_path(tmp, '/');
+
+    for (size_t t = 0; t < build->tracks.size(); t++) {
+        if (build->parts[v][t] != part->part)
+            continue;
+
+        Track *track = build->tracks[t];
+        Node *node = part->top;
+
+        for (size_t i = 1; i < paths.size(); i++) {
+            string path = fusepod_check_string(expand_string(track, paths[i]));
+
+            NodeValue nv(part->strings.get(path.c_str()), MODE_DIR);
+            if (i == paths.size() - 1) {
+                nv.mode = MODE_FILE;
+                nv.track = track;
+                nv.size = track->size;
+            }
+
+            Node *n = node->find(nv);
+            if (n == 0)
+                n = node->addChild(nv);
+            node = n;
         }
     }
 
-    DIR * music = opendir ( (mount_point + "/iPod_Control/Music").c_str() );
+    free(tmp);
+}
+
+void FUSEPod::watch_config(const string &path) {
+    ConfigWatcher *watcher = new ConfigWatcher(this, path);
+    if (!watcher->start()) {
+        cout << "Could not watch " << path << " for changes" << endl;
+        delete watcher;
+        return;
+    }
+
+    MutexLock lock(mutex);
+    delete config;
+    config = watcher;
+}
+
+/**
+ * @return true if the directory called name in the root isn't made by the
+ * layout, eg Playlists.
+ */
+bool FUSEPod::is_reserved(const string &name) {
+    if (name == dir_playlists || name == dir_transfer || name == dir_fusepod)
+        return true;
+
+    Node *node = root->find(name.c_str());
+    if (!node)
+        return false;
+    if (!S_ISDIR(node->value.mode))
+        return true;
+
+    if (node == search_dir || node == query_dir)
+        return true;
+    for (size_t i = 0; i < ranking_dirs.size(); i++)
+        if (node == ranking_dirs[i])
+            return true;
 
-    struct dirent * dir_ent;
+    return false;
+}
+
+bool FUSEPod::set_paths_descs(const vector<string> &descs, size_t &added,
+                              size_t &removed) {
+    MutexLock lock(mutex);
+
+    vector<string> gone = paths_descs;
+    vector<string> kept;
+    vector<string> fresh;
+
+    for (size_t i = 0; i < descs.size(); i++) {
+        vector<string>::iterator old = find(gone.begin(), gone.end(),
+                                            descs[i]);
+        if (old != gone.end()) {
+            gone.erase(old);
+            kept.push_back(descs[i]);
+            continue;
+        }
 
-    // Now traverse the Music directory looking at each mp3
-    while ((dir_ent = readdir(music))) {
-        if (strcmp(dir_ent->d_name, ".")  == 0 ||
-            strcmp(dir_ent->d_name, "..") == 0)
+        string name = literal_root(descs[i]);
+        if (name != "" && is_reserved(name)) {
+            cout << "Not adding " << descs[i] << ": " << name
+                 << " is used by FUSEPod" << endl;
             continue;
+        }
+
+        fresh.push_back(descs[i]);
+    }
+
+    added = fresh.size();
+    removed = gone.size();
+    if (added == 0 && removed == 0)
+        return false;
+
+    // Evicted directories are rebuilt from their own path description
+    for (size_t i = 0; budget && i < gone.size() + fresh.size(); i++) {
+        string name = literal_root(i < gone.size() ? gone[i] :
+                                   fresh[i - gone.size()]);
+        Node *node = name == "" ? root : root->find(name.c_str());
+        if (node)
+            materialize(node);
+    }
+
+    string playlist_desc = playlist_view < paths_descs.size() ?
+        paths_descs[playlist_view] : "";
+
+    for (size_t i = 0; i < gone.size(); i++)
+        remove_view(gone[i], kept);
+
+    for (size_t i = 0; i < fresh.size(); i++) {
+        add_view(fresh[i]);
+        kept.push_back(fresh[i]);
+    }
+
+    // Kept in the order of the configuration file
+    paths_descs.clear();
+    for (size_t i = 0; i < descs.size(); i++)
+        if (find(kept.begin(), kept.end(), descs[i]) != kept.end())
+            paths_descs.push_back(descs[i]);
+
+    vector<string>::iterator view = find(paths_descs.begin(),
+                                         paths_descs.end(), playlist_desc);
+    if (view != paths_descs.end()) {
+        playlist_view = view - paths_descs.begin();
+    } else {
+        // The paths in the playlist files change
+        playlist_view = 0;
+        for (GList *i = ipod->playlists; i; i = i->next)
+            playlist_changed((Playlist*) i->data);
+    }
+
+    find_view_roots();
+    enforce_budget();
+
+    events->post("changed");
+
+    return true;
+}
+
+void FUSEPod::add_view(const string &path_desc) {
+    for (GList *i = ipod->tracks; i; i = i->next)
+        add_track((Track*) i->data, path_desc);
+}
 
-        DIR * subdir = opendir ( (mount_point + "/iPod_Control/Music/" + dir_ent->d_name).c_str() );
+/**
+ * Takes down the nodes of a view. If no other view can share its first
+ * directory, the directory is dropped in one go instead of track by track.
+ * @param kept The path descriptions which stay.
+ */
+void FUSEPod::remove_view(const string &path_desc,
+                          const vector<string> &kept) {
+    string name = literal_root(path_desc);
+    bool shared = name == "" || is_reserved(name);
+
+    for (size_t i = 0; i < kept.size() && !shared; i++) {
+        string other = literal_root(kept[i]);
+        shared = other == "" || other == name;
+    }
+
+    Node *node = shared ? 0 : root->find(name.c_str());
+    if (node) {
+        if (budget)
+            budget->forget(node);
+        node->remove_from_parent();
+        delete node;
+        return;
+    }
+
+    for (GList *i = ipod->tracks; i; i = i->next)
+        remove_track((Track*) i->data, path_desc);
+}
+
+/**
+ * Finds the views whose subdirectories can be evicted. They have a top
+ * directory of their own, eg /Artists/%a/%A/%t.%e, so everything below
+ * it comes from the one path description.
+ */
+void FUSEPod::find_view_roots() {
+    view_roots.clear();
 
-        if (!subdir)
+    for (size_t i = 0; i < paths_descs.size(); i++) {
+        string name = literal_root(paths_descs[i]);
+        if (name == "" || is_reserved(name) ||
+            count(paths_descs[i].begin(), paths_descs[i].end(), '/') < 3)
             continue;
 
-        struct dirent * subdir_ent;
+        bool shared = false;
+        for (size_t j = 0; j < paths_descs.size() && !shared; j++) {
+            string other = literal_root(paths_descs[j]);
+            shared = j != i && (other == "" || other == name);
+        }
 
-        // These files should be mp3s in the db. If they are not in files_in_itdb,
-        // the song gets added to the database.
-        while ((subdir_ent = readdir(subdir))) {
-            if (strcmp(subdir_ent->d_name, ".")  == 0 ||
-                strcmp(subdir_ent->d_name, "..") == 0)
-                continue;
+        Node *node = root->find(name.c_str());
+        if (!shared && node)
+            view_roots.push_back(make_pair(node, paths_descs[i]));
+    }
+}
+
+bool FUSEPod::is_view_root(Node *node) {
+    for (size_t i = 0; i < view_roots.size(); i++)
+        if (view_roots[i].first == node)
+            return true;
+    return false;
+}
+
+/**
+ * Rebuilds a directory which was evicted.
+ */
+void FUSEPod::restore_dir(Node *dir) {
+    double start = fusepod_now();
+
+    string path_desc;
+    vector<Track*> tracks;
+    budget->restore(dir, path_desc, tracks);
 
-            string path = "/" + string(dir_ent->d_name) + "/" + subdir_ent->d_name;
+    // Counted again as the subdirectories are added
+    dir->value.size = 0;
+    for (size_t i = 0; i < tracks.size(); i++)
+        add_track(tracks[i], path_desc);
 
-            if (files_in_itdb.find (path) == files_in_itdb.end ()) {
-                upload_song (mount_point + "/iPod_Control/Music" + path, false);
-                cout << path << " is not in the iTunesDB. Adding" << endl;
+    budget->touch(dir);
+    budget->rebuilt(fusepod_now() - start);
+}
+
+void FUSEPod::materialize(Node *node) {
+    MutexLock lock(mutex);
+
+    if (!budget)
+        return;
+
+    for (Node::iterator i = node->begin(); i != node->end(); ++i) {
+        if (budget->is_evicted(*i))
+            restore_dir(*i);
+        if (S_ISDIR((*i)->value.mode))
+            materialize(*i);
+    }
+}
+
+/**
+ * Evicts the least recently used directories of the views if the nodes use
+ * more than memory_budget.
+ */
+void FUSEPod::enforce_budget() {
+    if (!budget || !budget->over_budget())
+        return;
+
+    vector<NodeBudget::Candidate> candidates;
+    for (size_t i = 0; i < view_roots.size(); i++) {
+        Node *node = view_roots[i].first;
+        for (Node::iterator c = node->begin(); c != node->end(); ++c)
+            if (S_ISDIR((*c)->value.mode))
+                candidates.push_back(make_pair(*c, view_roots[i].second));
+    }
+
+    budget->evict(candidates);
+}
+
+/**
+ * Makes the directory in Search for the tracks with the words in query.
+ */
+Node *FUSEPod::add_search(const char *query) {
+    vector<Track*> tracks;
+    search->find(query, tracks);
+
+    return add_results(search_dir, query, tracks);
+}
+
+/**
+ * Makes the directory in Query for the tracks matching query, eg
+ * "year>=2000 and genre=Jazz".
+ * @return The null pointer if the query can't be understood.
+ */
+Node *FUSEPod::add_query(const char *query) {
+    vector<Track*> tracks;
+    if (!table->query(query, tracks))
+        return 0;
+
+    return add_results(query_dir, query, tracks);
+}
+
+/**
+ * Makes a directory listing tracks like a playlist does. Only the last few
+ * are kept.
+ */
+Node *FUSEPod::add_results(Node *dir, const char *name,
+                           const vector<Track*> &tracks) {
+    Node *node = dir->addChild(NodeValue(strdup(name), MODE_DIR));
+
+    // Numbered, so songs with the same artist and title are all listed
+    for (size_t i = 0; i < tracks.size(); i++)
+        node->addChild(numbered_entry(i + 1, tracks.size(), tracks[i]));
+
+    searches.push_back(node);
+    if (searches.size() > search_results_kept) {
+        Node *oldest = searches.front();
+        searches.pop_front();
+        oldest->remove_from_parent();
+        free((void*) oldest->value.text);
+        delete oldest;
+    }
+
+    return node;
+}
+
+/**
+ * Takes a track out of the searches which list it, before it is freed.
+ */
+void FUSEPod::forget_results(Track *track) {
+    for (size_t i = 0; i < searches.size(); i++) {
+        Node::iterator t = searches[i]->begin();
+        while (t != searches[i]->end()) {
+            Node *node = *t++;
+            if (node->value.track == track) {
+                searches[i]->children.erase(node);
+                delete node;
             }
         }
+    }
+}
 
-        closedir (subdir);
+/**
+ * Forgets every search. Called once the tracks have changed, rather than
+ * for each track, so a big upload doesn't keep making them again.
+ */
+void FUSEPod::clear_searches() {
+    for (size_t i = 0; i < searches.size(); i++) {
+        searches[i]->remove_from_parent();
+        free((void*) searches[i]->value.text);
+        delete searches[i];
+    }
+
+    searches.clear();
+}
+
+/**
+ * Makes the directories of the rankings, unless a layout already uses
+ * their names or the rankings are empty.
+ */
+void FUSEPod::add_rankings() {
+    for (size_t i = 0; i < rankings.size(); i++) {
+        Node *node = 0;
+        if (rankings[i]->get_size() > 0)
+            node = root->addChild(NodeValue(fusepod_get_string(
+                rankings[i]->get_name().c_str()), MODE_DIR));
+
+        ranking_dirs.push_back(node);
+        refresh_ranking(i);
     }
+}
+
+/**
+ * Makes the directory of a ranking list its top tracks again.
+ */
+void FUSEPod::refresh_ranking(size_t i) {
+    if (i >= ranking_dirs.size() || !ranking_dirs[i])
+        return;
 
-    closedir (music);
+    Node *node = ranking_dirs[i];
+    for (Node::iterator c = node->begin(); c != node->end(); ++c)
+        delete *c;
+    node->children.clear();
+
+    vector<Track*> tracks;
+    rankings[i]->top(tracks);
+
+    for (size_t pos = 0; pos < tracks.size(); pos++)
+        node->addChild(numbered_entry(pos + 1, tracks.size(), tracks[pos]));
 }
 
 bool FUSEPod::move_file(const string &path, Track *track) {
-    string subdir = mount_point + "/iPod_Control/Music/F";
-    string ext(path, path.rfind('.') + 1, path.size() - 1);
-    char *tmp = new char[subdir.size() + 3];
-    bool found = false;
-    int musicdirs = itdb_musicdirs_number(ipod);
-    int dirnum = rand() % musicdirs;
-    struct stat st;
+    string dest;
 
-    // Find a directory that exists from dirnum -> end
-    for (int i = dirnum; i < musicdirs && !found; i++) {
-        sprintf (tmp, "%s%02d", subdir.c_str(), i);
-        if ((found = !stat(tmp, &st)))
-            dirnum = i;
-    }
+    if (!assign_slot(path, track, dest))
+        return false;
 
-    // Find a directory that exists from 0 -> dirnum
-    for (int i = 0; i < dirnum && !found; i++) {
-        sprintf(tmp, "%s%02d", subdir.c_str(), i);
-        if ((found = !stat(tmp, &st)))
-            dirnum = i;
+    if (rename(path.c_str(), dest.c_str())) {
+        release_slot(track);
+        return false;
     }
 
-    subdir = string(tmp) + "/fusepod";
-    delete[] tmp;
+    return true;
+}
 
-    if (!found)
+/**
+ * Copies a song into a free slot in the Music directory. This does the same
+ * as itdb_cp_track_to_ipod, but uses slots to pick the filename.
+ */
+bool FUSEPod::copy_file(const string &path, Track *track) {
+    string dest;
+
+    if (!assign_slot(path, track, dest))
         return false;
 
-    tmp = new char[subdir.size() + 8 + ext.size()];
-    int filenum;
+    int in = open(path.c_str(), O_RDONLY);
+    int out = open(dest.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    bool ok = in != -1 && out != -1;
+
+    vector<char> buf(upload_copy_chunk);
+    while (ok) {
+        ssize_t len = read(in, &buf[0], buf.size());
+        if (len <= 0) {
+            ok = len == 0;
+            break;
+        }
+        ok = write(out, &buf[0], len) == len;
+    }
 
-    //Search for unused file
-    do {
-        filenum = rand() % 1000000;
-        sprintf(tmp, "%s%06d.%s", subdir.c_str(), filenum, ext.c_str());
-    } while (!stat (tmp, &st)); // Returns false when found file
+    // The copy is on the iPod before the journal says it was made
+    if (ok && fsync(out))
+        ok = false;
 
-    sprintf(tmp, ":iPod_Control:Music:F%02d:fusepod%06d.%s",
-            dirnum, filenum, ext.c_str());
-    track->ipod_path = g_strdup(tmp);
+    if (in != -1)
+        close(in);
+    if (out != -1 && close(out))
+        ok = false;
 
-    sprintf(tmp, "%s/iPod_Control/Music/F%02d/fusepod%06d.%s",
-            mount_point.c_str(), dirnum, filenum, ext.c_str());
-    if (rename(path.c_str(), tmp)) {
-        delete[] tmp;
+    if (!ok) {
+        if (out != -1)
+            unlink(dest.c_str());
+        release_slot(track);
         return false;
     }
 
-    delete[] tmp;
+    track->transferred = TRUE;
     return true;
 }
+
+/**
+ * Gives a track a free filename in the Music directory.
+ * @param dest Set to the absolute path of the filename.
+ */
+bool FUSEPod::assign_slot(const string &path, Track *track, string &dest) {
+    string ipod_path;
+
+    if (!allocate_slot(path, ipod_path, dest))
+        return false;
+
+    forget_real_path(track);
+    g_free(track->ipod_path);
+    track->ipod_path = g_strdup(ipod_path.c_str());
+
+    return true;
+}
+
+bool FUSEPod::allocate_slot(const string &path, string &ipod_path,
+                            string &real_path) {
+    size_t pos = path.rfind('.');
+    string ext = "tmp";
+    if (pos != string::npos && path.find('/', pos) == string::npos &&
+        pos + 1 < path.size())
+        ext = path.substr(pos + 1);
+
+    if (!slots->allocate(ext, ipod_path))
+        return false;
+
+    gchar *tmp = g_strdup(ipod_path.c_str());
+    itdb_filename_ipod2fs(tmp);
+    real_path = mount_point + tmp;
+    g_free(tmp);
+
+    return true;
+}
+
+/**
+ * Frees the slot of a track which never made it onto the iPod.
+ */
+void FUSEPod::release_slot(Track *track) {
+    slots->release(track->ipod_path);
+    forget_real_path(track);
+    g_free(track->ipod_path);
+    track->ipod_path = 0;
+}
@@ -17,20 +17,49 @@
 
 #include <gpod/itdb.h>
 
+#include "fusepod_util.h"
+
+extern "C" {
+#include <pthread.h>
+}
+
 #include <string>
 #include <cstring>
 #include <set>
 #include <vector>
+#include <deque>
+#include <utility>
 #include <iostream>
 
 using std::string;
 using std::vector;
+using std::deque;
 using std::set;
+using std::pair;
 
 typedef Itdb_iTunesDB IPod;
 typedef Itdb_Track Track;
 typedef Itdb_Playlist Playlist;
 
+class UploadQueue;
+class FingerprintIndex;
+class TrackCache;
+class HeaderCache;
+class SlotAllocator;
+class OrphanScanner;
+class DeferredCommit;
+class SyncJournal;
+class Importer;
+class ControlServer;
+class EventLog;
+class SearchIndex;
+class TrackTable;
+class Ranking;
+class ConfigWatcher;
+class NodeBudget;
+struct ViewBuild;
+struct ViewPart;
+
 struct NodeValue {
     NodeValue(const char *text = 0, mode_t mode = 0, Track *track = 0,
               off_t size = 0)
@@ -59,7 +88,7 @@ class Node {
   public:
     /* Constructors/Destructors */
     Node(const NodeValue &value, Node *parent = 0)
-        : value(value), parent(parent) {}
+        : value(value), parent(parent) { __sync_fetch_and_add(&count, 1); }
     ~Node();
 
     /* Typedefs */
@@ -99,6 +128,9 @@ class Node {
     Node *parent;
     /** The child nodes */
     set<Node*, nodecomp> children;
+
+    /** How many nodes there are. Views are built by several threads */
+    static size_t count;
 };
 
 /**
@@ -106,7 +138,8 @@ class Node {
  */
 class FUSEPod {
   public:
-    FUSEPod(const string &mount_point, vector<string> path_descs);
+    FUSEPod(const string &mount_point, vector<string> path_descs,
+            const Options &options);
     ~FUSEPod();
 
     /**
@@ -127,10 +160,45 @@ class FUSEPod {
     static bool create_itunes_dirs(const string &dir);
 
     /**
-     * This function will upload a song to the iPod.
+     * This function will upload a song to the iPod. The song is added to the
+     * iTunesDB, but not to the FUSEPod filesystem layout (see add_track).
+     * If the song is already on the iPod nothing is uploaded and the
+     * existing track is returned.
+     * This locks mutex itself and is safe to call from any thread.
      * @param copy If false will move song instead.
+     * @param duplicate If not null, set to whether the song was already on
+     * the iPod.
+     */
+    Track *upload_song(const string &path, bool copy = true,
+                       bool *duplicate = 0);
+
+    /**
+     * Adds a song which is already in the iPod's Music directory, but not in
+     * the iTunesDB, to the inmemory ITunesDB. The file is left where it is.
+     * @param path The absolute path of the song.
+     * @param ipod_path The iPod path of the song, eg
+     * ":iPod_Control:Music:F03:ABCD.mp3".
+     * @param tags Tags to use instead of those in the song, as given by
+     * match_path.
+     * @return The new track, or the null pointer if it can't be read.
+     */
+    Track *adopt_song(const string &path, const string &ipod_path,
+                      const map<char, string> &tags = map<char, string>());
+
+    /**
+     * @return The libgpod filetype of a song, going by its extension, or
+     * the null pointer if the iPod can't play it.
+     */
+    static const char *get_filetype(const string &path);
+
+    /**
+     * Reserves a free filename in the iPod's Music directory for a song.
+     * @param path The song, for its extension.
+     * @param ipod_path Set to the iPod path of the file.
+     * @param real_path Set to the absolute path of the file.
      */
-    Track *upload_song(const string &path, bool copy = true);
+    bool allocate_slot(const string &path, string &ipod_path,
+                       string &real_path);
 
     /**
      * This function will remove a song from the FUSEPod filesystem.
@@ -139,6 +207,7 @@ class FUSEPod {
      * @return true if the operation was successful
      */
     bool remove_song(const string &path);
+    bool remove_song(Track *track);
 
     /**
      * Removes a playlist from the FUSEPod filesystem aswell as the
@@ -146,24 +215,121 @@ class FUSEPod {
      */
     void remove_playlist(const string &name);
 
+    /**
+     * @return The playlist called name, or the null pointer.
+     */
+    Playlist *find_playlist(const string &name);
+
+    /**
+     * Adds an empty playlist to the inmemory ITunesDB and the FUSEPod
+     * filesystem.
+     * @return The new playlist, or the null pointer if one called name
+     * already exists.
+     */
+    Playlist *create_playlist(const string &name);
+
+    /**
+     * Adds a track to a playlist.
+     * @param pos Where to put it, counting from 1, or 0 for the end.
+     */
+    bool add_to_playlist(Playlist *playlist, Track *track, int pos = 0);
+
+    /**
+     * Removes the track at position pos, counting from 1, from a playlist.
+     */
+    bool remove_from_playlist(Playlist *playlist, int pos);
+
+    /**
+     * Moves the track at position from to position to, counting from 1.
+     */
+    bool move_in_playlist(Playlist *playlist, int from, int to);
+
+    /**
+     * @return A number which changes whenever the songs in a playlist, or
+     * where they are in the layout, change.
+     */
+    unsigned long get_playlist_version(Playlist *playlist);
+
+    /**
+     * @return The path of a track in the view made from the path
+     * description chosen by the playlist_view option, eg
+     * "/All/Deftones - Change.mp3".
+     */
+    string get_view_path(Track *track);
+
+    /**
+     * @return The path of a track in the view made from path description
+     * number view, counting from 0.
+     */
+    string get_view_path(Track *track, size_t view);
+
+    /**
+     * @return How many path descriptions there are.
+     */
+    size_t get_view_count() { return paths_descs.size(); }
+
+    /**
+     * Changes the layout to new path descriptions. Only the views whose
+     * path descriptions were added or removed are built or taken down, so
+     * the others keep their nodes.
+     * @param added Set to how many views were built.
+     * @param removed Set to how many views were taken down.
+     * @return false if the layout didn't change.
+     */
+    bool set_paths_descs(const vector<string> &descs, size_t &added,
+                         size_t &removed);
+
+    /**
+     * Applies changes to the path descriptions in the configuration file
+     * at path as soon as it is saved.
+     */
+    void watch_config(const string &path);
+
+    /**
+     * Rebuilds the directories under node which were evicted to keep
+     * within memory_budget, so the whole subtree can be walked.
+     */
+    void materialize(Node *node);
+
+    /**
+     * @return How many tracks have been taken out of the iTunesDB. When
+     * this changes, Track pointers kept without holding mutex may have
+     * been freed.
+     */
+    unsigned long get_removed_count() { return num_removed; }
+
     /**
      * This will flush the iPod and update the FUSEPod filesystem layout.
      * @return false if currently syncing
      */
     bool flush();
 
+    /**
+     * Writes the iTunesDB, and the files FUSEPod keeps next to it. Called
+     * with mutex held.
+     * @return false if the iTunesDB could not be written
+     */
+    bool write_db();
+
     /**
      * Returns the node corresponding to the path, or the null pointer.
+     * Any name in the Search or Query directories is a directory. Its
+     * tracks are only searched for, and the directory made, when a path
+     * goes into it or make is true, eg when it is listed.
      */
-    Node *get_node(const char *path);
+    Node *get_node(const char *path, bool make = false);
 
     /**
      * Returns the real path of a song.
-     * This is the path to the song on the mounted iPod.
+     * This is the path to the song on the mounted iPod. Finding it can mean
+     * reading the iPod's directories, so it is remembered until the track
+     * moves or is removed. The remembered paths have their own lock, so
+     * this doesn't wait for mutex unless the path is looked up by name.
      * @return An absolute path to the real file, or an empty string
      */
     string get_real_path(const NodeValue &nv);
     string get_real_path(const string &path);
+    string get_real_path(Track *track);
 
     /**
      * Returns the real path of a song in the transfer directory.
@@ -182,12 +348,102 @@ class FUSEPod {
      */
     void add_track(Track *track);
 
+    /**
+     * Removes a track from the FUSEPod filesystem layout, but not from the
+     * iTunesDB. To change the tags of a track, remove it, change them and
+     * add it again.
+     */
+    void remove_track(Track *track);
+
+    /**
+     * Works out which tags a track at path would have, using the path
+     * descriptions. eg "/Genre/Jazz/Miles Davis/Kind of Blue/01 - So
+     * What.mp3" with "/Genre/%g/%a/%A/%T - %t.%e" gives the genre, artist,
+     * album, track, title and extension.
+     * @param tags Set to the value of each symbol in the path description.
+     * @return false if no path description matches.
+     */
+    bool match_path(const string &path, map<char, string> &tags);
+
+    /**
+     * @return true if path is inside one of the directories made from the
+     * path descriptions, eg "/Artists/Deftones" but not "/Artists".
+     */
+    bool in_view(const string &path);
+
+    /**
+     * @return false if retag_track would refuse tags, eg because they
+     * change the extension.
+     */
+    bool can_retag(Track *track, const map<char, string> &tags);
+
+    /**
+     * Changes the tags of a track to those found by match_path, and moves
+     * it in the filesystem layout. The iTunesDB is written later.
+     * @return false if a tag can't be changed, eg the extension.
+     */
+    bool retag_track(Track *track, const map<char, string> &tags);
+
     IPod *ipod;
     Node *root;
     string mount_point;
 
+    /**
+     * Protects the iTunesDB and the filesystem tree. It must be held while
+     * using either, since the upload workers modify them in the background.
+     * It is recursive.
+     */
+    pthread_mutex_t mutex;
+
+    /** Songs which are uploaded in the background */
+    UploadQueue *uploads;
+
+    /** Used to find songs which are already on the iPod */
+    FingerprintIndex *fingerprints;
+
+    /** Songs on local disk. The null pointer if caching is off */
+    TrackCache *cache;
+
+    /** The start of songs. The null pointer if header caching is off */
+    HeaderCache *headers;
+
+    /** Free filenames in the iPod's Music directory */
+    SlotAllocator *slots;
+
+    /** Finds songs in the Music directory which are not in the iTunesDB */
+    OrphanScanner *orphans;
+
+    /** Writes the iTunesDB a while after tags are changed */
+    DeferredCommit *commits;
+
+    /** Songs being synced, so an interrupted sync can be resumed */
+    SyncJournal *journal;
+
+    /** Finds songs in directories to upload */
+    Importer *imports;
+
+    /** Takes requests over a unix socket. The null pointer if off */
+    ControlServer *control;
+
+    /** Reloads the layout when it changes. The null pointer if off */
+    ConfigWatcher *config;
+
+    /** Evicts directories of the layout to keep within memory_budget. The
+     *  null pointer if off */
+    NodeBudget *budget;
+
+    /** What FUSEPod has done recently, for the events file */
+    EventLog *events;
+
+    /** Finds tracks by the words in their tags */
+    SearchIndex *search;
+
+    /** Finds tracks by queries on their tags */
+    TrackTable *table;
+
   protected:
     string get_track_val(Track *track, char symbol);
+    void set_track_val(Track *track, char symbol, const string &val);
     string expand_string(Track *track, const string &format);
     void add_track(Track *track, const string &path_desc);
     void remove_track(Track *track, const string &path_desc);
@@ -195,14 +451,82 @@ class FUSEPod {
   private:
     vector<string> paths_descs;
     void add_playlists();
+    NodeValue playlist_entry(Playlist *playlist, int pos, Track *track);
+    NodeValue numbered_entry(int pos, int count, Track *track);
+    void refresh_playlist(Playlist *playlist);
+    void add_playlist_file(Node *pnode, Playlist *playlist);
+    Node *add_search(const char *query);
+    Node *add_query(const char *query);
+    Node *add_results(Node *dir, const char *name,
+                      const vector<Track*> &tracks);
+    void clear_searches();
+    void forget_results(Track *track);
+    void add_rankings();
+    void refresh_ranking(size_t i);
+    void playlist_changed(Playlist *playlist);
     void add_all_tracks();
+    ViewBuild *start_build(vector<size_t> &serial);
+    void finish_build(ViewBuild *build);
+    void run_workers(ViewBuild *build, size_t jobs);
+    void join_workers(ViewBuild *build);
+    static void *build_main(void *build);
+    void partition_tracks(ViewBuild *build, size_t job);
+    void build_part(ViewBuild *build, ViewPart *part);
+    void add_view(const string &path_desc);
+    void remove_view(const string &path_desc, const vector<string> &kept);
+    bool is_reserved(const string &name);
+    void find_view_roots();
+    bool is_view_root(Node *node);
+    void restore_dir(Node *dir);
+    void enforce_budget();
     bool move_file(const string &path, Track *track);
-    void add_orphaned_tracks();
+    bool copy_file(const string &path, Track *track);
+    bool assign_slot(const string &path, Track *track, string &dest);
+    void release_slot(Track *track);
+    Track *read_song(const string &path);
+    Track *find_by_ipod_path(const string &ipod_path);
+    void add_to_itdb(Track *track);
+    void forget_real_path(Track *track);
+
+    /** The real path of tracks which have been looked up */
+    map<Track*, string> real_paths;
+    /** Protects real_paths. Nothing else is locked while it is held */
+    pthread_mutex_t real_paths_mutex;
+    /** Counts calls to forget_real_path, so a path found meanwhile isn't
+     *  remembered */
+    unsigned long real_paths_forgotten;
+
+    /** Set from playlist_version_count when a playlist changes */
+    map<Playlist*, unsigned long> playlist_versions;
+    unsigned long playlist_version_count;
+    /** The path description used for the paths in playlist files */
+    size_t playlist_view;
+
+    /** The Search directory, or the null pointer if a layout uses it */
+    Node *search_dir;
+    /** The Query directory, or the null pointer if a layout uses it */
+    Node *query_dir;
+    /** The directories in search_dir and query_dir, oldest first */
+    deque<Node*> searches;
+    /** Stands in for directories in search_dir and query_dir which haven't
+     *  been made */
+    Node *result_stub;
+
+    /** The top directories of views which no other view shares, and their
+     *  path descriptions. Their subdirectories may be evicted */
+    vector<pair<Node*, string> > view_roots;
+
+    /** Most Played, Top Rated and Recently Added */
+    vector<Ranking*> rankings;
+    /** The directory of each ranking, or the null pointer if a layout uses
+     *  its name */
+    vector<Node*> ranking_dirs;
 
     bool syncing;
     string syncing_file;
     int num_tracks;
     int num_playlists;
+    unsigned long num_removed;
 };
 
 #endif
@@ -0,0 +1,274 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_journal.cpp                                 *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_journal.h"
+#include "fusepod_ipod.h"
+#include "fusepod_upload.h"
+#include "fusepod_util.h"
+#include "fusepod_constants.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+}
+
+using namespace std;
+
+SyncJournal::SyncJournal(const string &file)
+    : file (file), batch_lines (0), fusepod (0), resuming (false),
+      stopping (false),
+      num_resumed (0) {
+    pthread_mutex_init(&mutex, 0);
+
+    ifstream in(file.c_str());
+    string line;
+
+    while (getline(in, line)) {
+        if (line.size() < 3 || line[1] != '\t')
+            continue;
+
+        string rest = line.substr(2);
+        size_t tab = rest.find('\t');
+
+        if (line[0] == 'P')
+            planned.push_back(rest);
+        else if (line[0] == 'D')
+            finished.insert(rest);
+        else if (line[0] == 'C' && tab != string::npos) {
+            copies.push_back(make_pair(rest.substr(0, tab),
+                                       rest.substr(tab + 1)));
+            finished.insert(rest.substr(tab + 1));
+        }
+    }
+
+    fd = open(file.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+}
+
+SyncJournal::~SyncJournal() {
+    stop();
+
+    {
+        MutexLock lock(mutex);
+        write_batch();
+    }
+
+    if (fd != -1)
+        close(fd);
+
+    pthread_mutex_destroy(&mutex);
+}
+
+void SyncJournal::stop() {
+    {
+        MutexLock lock(mutex);
+        if (!resuming)
+            return;
+        stopping = true;
+    }
+
+    pthread_join(thread, 0);
+
+    MutexLock lock(mutex);
+    resuming = false;
+}
+
+void SyncJournal::plan(const vector<string> &paths) {
+    MutexLock lock(mutex);
+
+    string lines;
+    for (size_t i = 0; i < paths.size(); i++) {
+        planned.push_back(paths[i]);
+        finished.erase(paths[i]);
+        lines += "P\t" + paths[i] + "\n";
+    }
+
+    append(lines);
+}
+
+void SyncJournal::copied(const string &ipod_path, const string &path) {
+    MutexLock lock(mutex);
+
+    copies.push_back(make_pair(ipod_path, path));
+    finished.insert(path);
+    append("C\t" + ipod_path + "\t" + path + "\n", true);
+}
+
+void SyncJournal::done(const string &path) {
+    MutexLock lock(mutex);
+
+    finished.insert(path);
+    append("D\t" + path + "\n", true);
+}
+
+void SyncJournal::committed() {
+    MutexLock lock(mutex);
+
+    vector<string> remaining;
+    for (size_t i = 0; i < planned.size(); i++)
+        if (finished.find(planned[i]) == finished.end())
+            remaining.push_back(planned[i]);
+
+    // Rewrite the journal with only the songs still to be uploaded. It is
+    // on the iPod before it replaces the old one
+    string lines;
+    for (size_t i = 0; i < remaining.size(); i++)
+        lines += "P\t" + remaining[i] + "\n";
+
+    string tmp = file + ".new";
+    int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out == -1)
+        return;
+    bool ok = write(out, lines.data(), lines.size()) == (ssize_t) lines.size();
+    if (fsync(out))
+        ok = false;
+    if (close(out))
+        ok = false;
+
+    if (!ok || rename(tmp.c_str(), file.c_str())) {
+        unlink(tmp.c_str());
+        return;
+    }
+
+    if (fd != -1)
+        close(fd);
+    fd = open(file.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+
+    planned.swap(remaining);
+    finished.clear();
+    copies.clear();
+    batch.clear();
+    batch_lines = 0;
+}
+
+void SyncJournal::resume(FUSEPod *fusepod) {
+    MutexLock lock(mutex);
+
+    if (resuming || (copies.empty() && count_remaining() == 0))
+        return;
+
+    this->fusepod = fusepod;
+    resuming = !pthread_create(&thread, 0, resume_main, this);
+}
+
+string SyncJournal::get_statistics() {
+    MutexLock lock(mutex);
+    ostringstream stats;
+
+    stats << "Journal Planned: " << planned.size() << endl
+          << "Journal Remaining: " << count_remaining() << endl
+          << "Journal Resumed: " << num_resumed << endl;
+
+    return stats.str();
+}
+
+void *SyncJournal::resume_main(void *journal) {
+    ((SyncJournal*) journal)->run_resume();
+    return 0;
+}
+
+/**
+ * Queues the songs left by an interrupted sync. The upload queue records
+ * their progress in the journal again as they are uploaded.
+ */
+void SyncJournal::run_resume() {
+    vector<pair<string, string> > adopt;
+    vector<string> upload;
+
+    {
+        MutexLock lock(mutex);
+
+        adopt = copies;
+        for (size_t i = 0; i < planned.size(); i++)
+            if (finished.find(planned[i]) == finished.end())
+                upload.push_back(planned[i]);
+    }
+
+    cout << "Resuming sync: " << adopt.size() << " songs were copied, "
+         << upload.size() << " songs still to upload" << endl;
+
+    for (size_t i = 0; i < adopt.size(); i++) {
+        gchar *tmp = g_strdup(adopt[i].first.c_str());
+        itdb_filename_ipod2fs(tmp);
+        string real_path = fusepod->mount_point + tmp;
+        g_free(tmp);
+
+        {
+            MutexLock lock(mutex);
+            if (stopping)
+                return;
+            num_resumed++;
+        }
+
+        // The copy was lost, so the song is uploaded again
+        struct stat st;
+        if (stat(real_path.c_str(), &st)) {
+            fusepod->uploads->push(UploadJob(adopt[i].second));
+            continue;
+        }
+
+        UploadJob job(real_path, false, adopt[i].first);
+        job.source = adopt[i].second;
+        fusepod->uploads->push(job);
+    }
+
+    for (size_t i = 0; i < upload.size(); i++) {
+        {
+            MutexLock lock(mutex);
+            if (stopping)
+                return;
+            num_resumed++;
+        }
+
+        fusepod->uploads->push(UploadJob(upload[i]));
+    }
+}
+
+/**
+ * Appends lines to the journal, and makes sure they are on the iPod. Lines
+ * which are batched are only written once there are journal_batch_lines of
+ * them, or with the next lines which aren't. Called with mutex held.
+ */
+void SyncJournal::append(const string &line, bool batched) {
+    batch += line;
+    if (!batched || ++batch_lines >= journal_batch_lines)
+        write_batch();
+}
+
+/**
+ * Called with mutex held.
+ */
+void SyncJournal::write_batch() {
+    if (fd != -1 && batch != "" &&
+        write(fd, batch.data(), batch.size()) == (ssize_t) batch.size())
+        fsync(fd);
+
+    batch.clear();
+    batch_lines = 0;
+}
+
+/**
+ * Called with mutex held.
+ */
+size_t SyncJournal::count_remaining() {
+    size_t count = 0;
+    for (size_t i = 0; i < planned.size(); i++)
+        if (finished.find(planned[i]) == finished.end())
+            count++;
+    return count;
+}
@@ -0,0 +1,126 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_journal.h                                   *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_JOURNAL_H_
+#define _FUSEPOD_JOURNAL_H_
+
+extern "C" {
+#include <pthread.h>
+}
+
+#include <string>
+#include <vector>
+#include <set>
+#include <utility>
+
+using std::string;
+using std::vector;
+using std::set;
+using std::pair;
+
+class FUSEPod;
+
+/**
+ * Remembers on the iPod which songs a sync is going to upload, and which it
+ * has copied, until the iTunesDB has been written. If FUSEPod stops or the
+ * iPod is unplugged in the middle of a sync, the next mount adds the songs
+ * which were copied without copying them again, and uploads the rest.
+ *
+ * Each line of the journal is one of
+ *   P<tab>path                  path is to be uploaded
+ *   C<tab>ipod_path<tab>path    path has been copied to ipod_path
+ *   D<tab>path                  path needs no copy, eg it is a duplicate
+ */
+class SyncJournal {
+  public:
+    SyncJournal(const string &file);
+
+    /**
+     * Stops resuming.
+     */
+    ~SyncJournal();
+
+    /**
+     * Stops queueing the songs of an interrupted sync. Songs which have
+     * already been queued are still uploaded.
+     */
+    void stop();
+
+    /**
+     * Notes the songs a sync is about to upload.
+     */
+    void plan(const vector<string> &paths);
+
+    /**
+     * Notes that a song has been copied onto the iPod. These are written
+     * to the iPod journal_batch_lines at a time, so if the sync is
+     * interrupted the last few copies may be made again, or left for the
+     * OrphanScanner.
+     */
+    void copied(const string &ipod_path, const string &path);
+
+    /**
+     * Notes that a song was not copied, eg because it is already on the
+     * iPod or can't be read. Batched like copied.
+     */
+    void done(const string &path);
+
+    /**
+     * Forgets everything that has been copied. Call this once the iTunesDB
+     * has been written. Songs still to be uploaded are kept.
+     */
+    void committed();
+
+    /**
+     * Queues what an interrupted sync left undone: songs which were copied
+     * are added to the iTunesDB where they are, and planned songs which
+     * were not copied are uploaded. This happens in the background.
+     */
+    void resume(FUSEPod *fusepod);
+
+    /**
+     * @return A multiline string with statistics, in the same format as
+     * FUSEPod::get_statistics.
+     */
+    string get_statistics();
+
+  private:
+    static void *resume_main(void *journal);
+    void run_resume();
+    void append(const string &line, bool batched = false);
+    void write_batch();
+    size_t count_remaining();
+
+    string file;
+    int fd;
+    /** Lines not written to the journal yet, and how many */
+    string batch;
+    size_t batch_lines;
+
+    /** Songs planned, in order, and those which need no more work */
+    vector<string> planned;
+    set<string> finished;
+    /** Songs copied since the iTunesDB was last written */
+    vector<pair<string, string> > copies;
+
+    FUSEPod *fusepod;
+    bool resuming;
+    bool stopping;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+
+    unsigned long num_resumed;
+};
+
+#endif
@@ -0,0 +1,304 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_orphans.cpp                                 *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_orphans.h"
+#include "fusepod_ipod.h"
+#include "fusepod_upload.h"
+#include "fusepod_slots.h"
+#include "fusepod_util.h"
+#include "fusepod_constants.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cctype>
+
+extern "C" {
+#include <sys/stat.h>
+#include <dirent.h>
+}
+
+using namespace std;
+
+/**
+ * The key of a file in the Music directory. iPods don't care about case.
+ */
+static string orphan_key(int dir, const string &filename) {
+    char tmp[16];
+    snprintf(tmp, sizeof(tmp), "%02d/", dir);
+
+    string key = tmp + filename;
+    for (size_t i = 0; i < key.size(); i++)
+        key[i] = tolower(key[i]);
+    return key;
+}
+
+OrphanScanner::OrphanScanner(FUSEPod *fusepod, const string &file)
+    : fusepod (fusepod), file (file),
+      music_dir (fusepod->mount_point + "/iPod_Control/Music"),
+      num_dirs (0), next_dir (0), state ("Not Started"), running (false),
+      stopping (false), num_read (0), num_skipped (0), num_orphans (0) {
+    pthread_mutex_init(&mutex, 0);
+
+    ifstream in(file.c_str());
+    int dir;
+    time_t mtime;
+    while (in >> dir >> mtime)
+        mtimes[dir] = mtime;
+}
+
+OrphanScanner::~OrphanScanner() {
+    stop();
+    pthread_mutex_destroy(&mutex);
+}
+
+void OrphanScanner::start() {
+    MutexLock lock(mutex);
+
+    if (running)
+        return;
+
+    running = !pthread_create(&thread, 0, scan_main, this);
+}
+
+void OrphanScanner::stop() {
+    {
+        MutexLock lock(mutex);
+        if (!running)
+            return;
+        stopping = true;
+    }
+
+    pthread_join(thread, 0);
+
+    MutexLock lock(mutex);
+    running = false;
+}
+
+void OrphanScanner::save() {
+    MutexLock lock(mutex);
+
+    ofstream out(file.c_str());
+    if (!out)
+        return;
+
+    for (map<int, time_t>::iterator i = mtimes.begin(); i != mtimes.end(); ++i)
+        out << i->first << ' ' << i->second << '\n';
+}
+
+string OrphanScanner::get_statistics() {
+    MutexLock lock(mutex);
+    ostringstream stats;
+
+    stats << "Orphan Scan: " << state << endl
+          << "Orphan Scan Directories Read: " << num_read << endl
+          << "Orphan Scan Directories Skipped: " << num_skipped << endl
+          << "Orphaned Tracks: " << num_orphans << endl;
+
+    return stats.str();
+}
+
+void *OrphanScanner::scan_main(void *scanner) {
+    ((OrphanScanner*) scanner)->run();
+    return 0;
+}
+
+void *OrphanScanner::walk_main(void *scanner) {
+    ((OrphanScanner*) scanner)->walk();
+    return 0;
+}
+
+bool OrphanScanner::is_stopping() {
+    MutexLock lock(mutex);
+    return stopping;
+}
+
+/**
+ * Lists the songs in the iTunesDB, then reads the Music directories on
+ * orphan_scan_workers threads. Anything found is checked again against the
+ * iTunesDB, since songs may have been uploaded during the scan, before it is
+ * queued for adding.
+ */
+void OrphanScanner::run() {
+    {
+        MutexLock lock(fusepod->mutex);
+        num_dirs = itdb_musicdirs_number(fusepod->ipod);
+    }
+
+    set<string> tmp;
+    list_known(tmp);
+
+    {
+        MutexLock lock(mutex);
+        known.swap(tmp);
+        found.clear();
+        scanned.clear();
+        next_dir = 0;
+        state = "Scanning";
+    }
+
+    vector<pthread_t> walkers;
+    for (int i = 0; i < orphan_scan_workers; i++) {
+        pthread_t walker;
+        if (pthread_create(&walker, 0, walk_main, this) == 0)
+            walkers.push_back(walker);
+    }
+
+    if (walkers.empty())
+        walk();
+
+    for (size_t i = 0; i < walkers.size(); i++)
+        pthread_join(walkers[i], 0);
+
+    list_known(tmp);
+
+    vector<pair<string, string> > orphans;
+    {
+        MutexLock lock(mutex);
+
+        for (size_t i = 0; i < found.size(); i++) {
+            int dir;
+            string filename;
+            SlotAllocator::parse_ipod_path(found[i].second.c_str(), dir,
+                                           filename);
+            if (tmp.find(orphan_key(dir, filename)) == tmp.end())
+                orphans.push_back(found[i]);
+        }
+
+        known.clear();
+        found.clear();
+        num_orphans += orphans.size();
+    }
+
+    if (!orphans.empty())
+        cout << "Found " << orphans.size()
+             << " songs which are not in the iTunesDB. Adding" << endl;
+
+    for (size_t i = 0; i < orphans.size(); i++) {
+        if (is_stopping())
+            break;
+        fusepod->uploads->push(UploadJob(orphans[i].first, true,
+                                         orphans[i].second));
+    }
+
+    // Only skip directories next time once their orphans have been added
+    fusepod->uploads->wait();
+
+    MutexLock lock(mutex);
+
+    if (stopping) {
+        state = "Stopped";
+        return;
+    }
+
+    for (map<int, time_t>::iterator i = scanned.begin(); i != scanned.end();
+         ++i)
+        mtimes[i->first] = i->second;
+
+    state = "Finished";
+}
+
+/**
+ * Reads Music directories until there are none left.
+ */
+void OrphanScanner::walk() {
+    time_t started = time(0);
+
+    for (;;) {
+        int dir;
+
+        {
+            MutexLock lock(mutex);
+            if (stopping || next_dir >= num_dirs)
+                return;
+            dir = next_dir++;
+        }
+
+        char name[8];
+        snprintf(name, sizeof(name), "F%02d", dir);
+        string path = music_dir + "/" + name;
+
+        struct stat st;
+        if (stat(path.c_str(), &st))
+            continue;
+
+        {
+            MutexLock lock(mutex);
+            map<int, time_t>::iterator m = mtimes.find(dir);
+            if (m != mtimes.end() && m->second == st.st_mtime) {
+                num_skipped++;
+                continue;
+            }
+        }
+
+        DIR *d = opendir(path.c_str());
+        if (!d)
+            continue;
+
+        vector<pair<string, string> > orphans;
+        struct dirent *ent;
+        bool complete = st.st_mtime < started;
+
+        while ((ent = readdir(d))) {
+            if (ent->d_name[0] == '.')
+                continue;
+
+            // known is not changed while the walkers run
+            if (known.find(orphan_key(dir, ent->d_name)) != known.end())
+                continue;
+
+            // Songs still being written aren't orphans yet
+            struct stat file_st;
+            string file = path + "/" + ent->d_name;
+            if (stat(file.c_str(), &file_st) ||
+                file_st.st_mtime > started - orphan_min_age) {
+                complete = false;
+                continue;
+            }
+
+            orphans.push_back(make_pair(file, string(":iPod_Control:Music:") +
+                                        name + ":" + ent->d_name));
+        }
+
+        closedir(d);
+
+        MutexLock lock(mutex);
+        found.insert(found.end(), orphans.begin(), orphans.end());
+        num_read++;
+
+        // A file added in the same second would not change the time, and
+        // recent files must be looked at again
+        if (complete)
+            scanned[dir] = st.st_mtime;
+    }
+}
+
+/**
+ * Lists the key of every song in the iTunesDB.
+ */
+void OrphanScanner::list_known(set<string> &known) {
+    known.clear();
+
+    MutexLock lock(fusepod->mutex);
+
+    for (GList *i = fusepod->ipod->tracks; i; i = i->next) {
+        Track *track = (Track*) i->data;
+        int dir;
+        string filename;
+
+        if (SlotAllocator::parse_ipod_path(track->ipod_path, dir, filename))
+            known.insert(orphan_key(dir, filename));
+    }
+}
@@ -0,0 +1,114 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_orphans.h                                   *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_ORPHANS_H_
+#define _FUSEPOD_ORPHANS_H_
+
+extern "C" {
+#include <pthread.h>
+#include <time.h>
+}
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+
+using std::string;
+using std::vector;
+using std::set;
+using std::map;
+
+class FUSEPod;
+
+/**
+ * Finds songs in the iPod's iPod_Control/Music/Fxx directories which are not
+ * in the iTunesDB, eg because the iTunesDB was written before an upload
+ * finished, and adds them through the upload queue. The directories are
+ * read in parallel on background threads. The modification time of every
+ * directory is remembered, so later scans only read directories which have
+ * changed.
+ */
+class OrphanScanner {
+  public:
+    /**
+     * @param file Where the directory modification times are kept.
+     */
+    OrphanScanner(FUSEPod *fusepod, const string &file);
+
+    /**
+     * Stops scanning.
+     */
+    ~OrphanScanner();
+
+    /**
+     * Starts scanning in the background.
+     */
+    void start();
+
+    /**
+     * Stops scanning and waits for the scan thread to finish. Songs which
+     * have already been queued are still uploaded.
+     */
+    void stop();
+
+    /**
+     * Writes the modification times of the directories whose orphans have
+     * been added. Call this after the iTunesDB has been written.
+     */
+    void save();
+
+    /**
+     * @return A multiline string with statistics, in the same format as
+     * FUSEPod::get_statistics.
+     */
+    string get_statistics();
+
+  private:
+    static void *scan_main(void *scanner);
+    static void *walk_main(void *scanner);
+    void run();
+    void walk();
+    void list_known(set<string> &known);
+    bool is_stopping();
+
+    FUSEPod *fusepod;
+    string file;
+    string music_dir;
+    int num_dirs;
+
+    /** Modification times of the directories which need not be read */
+    map<int, time_t> mtimes;
+    /** Modification times read during the current scan */
+    map<int, time_t> scanned;
+
+    /** The next directory for a walker to read */
+    int next_dir;
+    /** Lower case "dir/filename" of every song in the iTunesDB */
+    set<string> known;
+    /** The path and iPod path of songs not in the iTunesDB */
+    vector<std::pair<string, string> > found;
+
+    string state;
+    bool running;
+    bool stopping;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+
+    unsigned long num_read;
+    unsigned long num_skipped;
+    unsigned long num_orphans;
+};
+
+#endif
@@ -0,0 +1,293 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_query.cpp                                   *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_query.h"
+#include "fusepod_util.h"
+#include "fusepod_constants.h"
+
+#include <sstream>
+#include <cstdlib>
+#include <cctype>
+
+using namespace std;
+
+static gint32 query_year(Itdb_Track *track)      { return track->year; }
+static gint32 query_rating(Itdb_Track *track)    { return track->rating / ITDB_RATING_STEP; }
+static gint32 query_playcount(Itdb_Track *track) { return track->playcount; }
+static gint32 query_bitrate(Itdb_Track *track)   { return track->bitrate; }
+static gint32 query_length(Itdb_Track *track)    { return track->tracklen / 1000; }
+static gint32 query_track(Itdb_Track *track)     { return track->track_nr; }
+
+/**
+ * The tags which can be queried. Number tags come first, then text tags.
+ */
+static const struct {
+    const char *name;
+    gint32 (*number)(Itdb_Track *track);
+    gchar *Itdb_Track::*text;
+} query_fields[] = {
+    {"year",      query_year,      0},
+    {"rating",    query_rating,    0},
+    {"playcount", query_playcount, 0},
+    {"bitrate",   query_bitrate,   0},
+    {"length",    query_length,    0},
+    {"track",     query_track,     0},
+
+    {"artist",    0, &Itdb_Track::artist},
+    {"album",     0, &Itdb_Track::album},
+    {"genre",     0, &Itdb_Track::genre},
+    {"composer",  0, &Itdb_Track::composer},
+    {"title",     0, &Itdb_Track::title}
+};
+
+static const int num_query_fields = sizeof(query_fields) /
+                                    sizeof(query_fields[0]);
+static const int num_number_fields = 6;
+
+static string lower_case(const string &s) {
+    string ret = s;
+    for (size_t i = 0; i < ret.size(); i++)
+        ret[i] = tolower(ret[i]);
+    return ret;
+}
+
+TrackTable::TrackTable()
+    : numbers (num_number_fields),
+      texts (num_query_fields - num_number_fields), num_queries (0),
+      num_remembered (0) {
+}
+
+void TrackTable::add(Itdb_Track *track) {
+    map<Itdb_Track*, size_t>::iterator r = rows.find(track);
+    size_t row;
+
+    if (r != rows.end()) {
+        row = r->second;
+    } else {
+        row = tracks.size();
+        rows[track] = row;
+        tracks.push_back(track);
+        for (size_t i = 0; i < numbers.size(); i++)
+            numbers[i].push_back(0);
+        for (size_t i = 0; i < texts.size(); i++)
+            texts[i].ids.push_back(0);
+    }
+
+    for (int i = 0; i < num_number_fields; i++)
+        numbers[i][row] = query_fields[i].number(track);
+    for (int i = num_number_fields; i < num_query_fields; i++) {
+        TextColumn &column = texts[i - num_number_fields];
+        column.ids[row] = text_id(column, track->*(query_fields[i].text));
+    }
+
+    results.clear();
+}
+
+/**
+ * Moves the last row into the removed track's row, so rows stay packed.
+ */
+void TrackTable::remove(Itdb_Track *track) {
+    map<Itdb_Track*, size_t>::iterator r = rows.find(track);
+    if (r == rows.end())
+        return;
+
+    size_t row = r->second;
+    size_t last = tracks.size() - 1;
+    rows.erase(r);
+
+    if (row != last) {
+        tracks[row] = tracks[last];
+        rows[tracks[row]] = row;
+        for (size_t i = 0; i < numbers.size(); i++)
+            numbers[i][row] = numbers[i][last];
+        for (size_t i = 0; i < texts.size(); i++)
+            texts[i].ids[row] = texts[i].ids[last];
+    }
+
+    tracks.pop_back();
+    for (size_t i = 0; i < numbers.size(); i++)
+        numbers[i].pop_back();
+    for (size_t i = 0; i < texts.size(); i++)
+        texts[i].ids.pop_back();
+
+    results.clear();
+}
+
+bool TrackTable::query(const string &query, vector<Itdb_Track*> &matches) {
+    num_queries++;
+
+    map<string, vector<Itdb_Track*> >::iterator r = results.find(query);
+    if (r != results.end()) {
+        num_remembered++;
+        matches = r->second;
+        return true;
+    }
+
+    vector<Condition> conditions;
+    if (!parse(query, conditions))
+        return false;
+
+    vector<unsigned char> match(tracks.size(), 1);
+    for (size_t i = 0; i < conditions.size(); i++)
+        scan(conditions[i], match);
+
+    matches.clear();
+    for (size_t i = 0; i < match.size(); i++)
+        if (match[i])
+            matches.push_back(tracks[i]);
+
+    if (results.size() >= query_results_kept)
+        results.clear();
+    results[query] = matches;
+
+    return true;
+}
+
+bool TrackTable::is_valid(const string &query) {
+    vector<Condition> conditions;
+    return parse(query, conditions);
+}
+
+string TrackTable::get_statistics() {
+    ostringstream stats;
+
+    stats << "Queries: " << num_queries << endl
+          << "Queries Remembered: " << num_remembered << endl;
+
+    return stats.str();
+}
+
+/**
+ * Splits a query into its conditions.
+ */
+bool TrackTable::parse(const string &query, vector<Condition> &conditions) {
+    string lower = lower_case(query);
+    size_t start = 0;
+
+    for (;;) {
+        size_t end = lower.find(" and ", start);
+        string text = fusepod_strip_string(query.substr(start,
+            end == string::npos ? string::npos : end - start));
+
+        // The operator is the first one in the condition
+        Condition condition;
+        size_t pos = text.find_first_of("<>=!~");
+        if (pos == string::npos)
+            return false;
+
+        condition.op = text.substr(pos, 1);
+        if (pos + 1 < text.size() && text[pos + 1] == '=' &&
+            condition.op != "=" && condition.op != "~")
+            condition.op += '=';
+        if (condition.op == "!")
+            return false;
+
+        string name = lower_case(fusepod_strip_string(text.substr(0, pos)));
+        condition.value = fusepod_strip_string(
+            text.substr(pos + condition.op.size()));
+
+        condition.field = -1;
+        for (int i = 0; i < num_query_fields; i++)
+            if (name == query_fields[i].name)
+                condition.field = i;
+        if (condition.field == -1)
+            return false;
+
+        if (condition.field < num_number_fields) {
+            char *num_end;
+            strtol(condition.value.c_str(), &num_end, 10);
+            if (condition.value.empty() || *num_end || condition.op == "~")
+                return false;
+        } else {
+            condition.value = fusepod_fold_case(condition.value);
+        }
+
+        conditions.push_back(condition);
+
+        if (end == string::npos)
+            return true;
+        start = end + 5;
+    }
+}
+
+/**
+ * Clears match for the rows which don't meet condition.
+ */
+void TrackTable::scan(const Condition &condition,
+                      vector<unsigned char> &match) {
+    size_t n = match.size();
+    const string &op = condition.op;
+
+    if (condition.field < num_number_fields) {
+        const vector<gint32> &column = numbers[condition.field];
+        gint32 val = atoi(condition.value.c_str());
+
+        if (op == "=")
+            for (size_t i = 0; i < n; i++) match[i] &= column[i] == val;
+        else if (op == "!=")
+            for (size_t i = 0; i < n; i++) match[i] &= column[i] != val;
+        else if (op == "<")
+            for (size_t i = 0; i < n; i++) match[i] &= column[i] < val;
+        else if (op == "<=")
+            for (size_t i = 0; i < n; i++) match[i] &= column[i] <= val;
+        else if (op == ">")
+            for (size_t i = 0; i < n; i++) match[i] &= column[i] > val;
+        else if (op == ">=")
+            for (size_t i = 0; i < n; i++) match[i] &= column[i] >= val;
+        return;
+    }
+
+    // Text is compared once per distinct value, rather than once per row
+    TextColumn &column = texts[condition.field - num_number_fields];
+    vector<unsigned char> ok(column.values.size());
+
+    for (size_t v = 0; v < column.values.size(); v++) {
+        int cmp = column.values[v].compare(condition.value);
+
+        if (op == "~")
+            ok[v] = column.values[v].find(condition.value) != string::npos;
+        else if (op == "=")
+            ok[v] = cmp == 0;
+        else if (op == "!=")
+            ok[v] = cmp != 0;
+        else if (op == "<")
+            ok[v] = cmp < 0;
+        else if (op == "<=")
+            ok[v] = cmp <= 0;
+        else if (op == ">")
+            ok[v] = cmp > 0;
+        else
+            ok[v] = cmp >= 0;
+    }
+
+    const vector<int> &ids = column.ids;
+    for (size_t i = 0; i < n; i++)
+        match[i] &= ok[ids[i]];
+}
+
+/**
+ * @return The id of a text value, giving it one if it's new.
+ */
+int TrackTable::text_id(TextColumn &column, const char *text) {
+    string value = fusepod_fold_case(fusepod_strip_string(text ? text : ""));
+
+    map<string, int>::iterator i = column.dict.find(value);
+    if (i != column.dict.end())
+        return i->second;
+
+    int id = column.values.size();
+    column.dict[value] = id;
+    column.values.push_back(value);
+    return id;
+}
@@ -0,0 +1,101 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_query.h                                     *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_QUERY_H_
+#define _FUSEPOD_QUERY_H_
+
+#include <gpod/itdb.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+using std::string;
+using std::vector;
+using std::map;
+
+/**
+ * A copy of the tags of every track which queries such as
+ * "year>=2000 and genre=Jazz" are answered from. Each tag is kept in its
+ * own array, and text tags are kept as numbers standing for their lower
+ * cased value, so a query is a few tight loops over arrays. Results are
+ * remembered until a track changes. Not thread safe; callers hold
+ * FUSEPod::mutex.
+ */
+class TrackTable {
+  public:
+    TrackTable();
+
+    /**
+     * Adds a track, or updates it if its tags have changed.
+     */
+    void add(Itdb_Track *track);
+
+    /**
+     * Removes a track.
+     */
+    void remove(Itdb_Track *track);
+
+    /**
+     * Finds the tracks matching a query. A query is conditions joined by
+     * "and". Each condition is a tag, an operator and a value, eg
+     * "rating>=4". The operators are =, !=, <, <=, >, >= and ~, which
+     * means contains.
+     * @param tracks Set to the matching tracks.
+     * @return false if the query can't be understood.
+     */
+    bool query(const string &query, vector<Itdb_Track*> &tracks);
+
+    /**
+     * @return true if query can be understood.
+     */
+    bool is_valid(const string &query);
+
+    /**
+     * @return A multiline string with statistics, in the same format as
+     * FUSEPod::get_statistics.
+     */
+    string get_statistics();
+
+  private:
+    /** A text tag. Each row holds the id of its value */
+    struct TextColumn {
+        vector<int> ids;
+        map<string, int> dict;
+        vector<string> values;
+    };
+
+    struct Condition {
+        int field;
+        string op;
+        string value;
+    };
+
+    bool parse(const string &query, vector<Condition> &conditions);
+    void scan(const Condition &condition, vector<unsigned char> &match);
+    int text_id(TextColumn &column, const char *text);
+
+    vector<Itdb_Track*> tracks;
+    map<Itdb_Track*, size_t> rows;
+    vector<vector<gint32> > numbers;
+    vector<TextColumn> texts;
+
+    /** Results of queries since the last change */
+    map<string, vector<Itdb_Track*> > results;
+
+    unsigned long num_queries;
+    unsigned long num_remembered;
+};
+
+#endif
@@ -0,0 +1,248 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_readahead.cpp                               *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+extern "C" {
+#ifdef linux
+/* For pread() */
+#define _XOPEN_SOURCE 500
+#endif
+
+#include <unistd.h>
+#include <errno.h>
+}
+
+#include "fusepod_readahead.h"
+#include "fusepod_util.h"
+#include "fusepod_constants.h"
+
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+/* Statistics shared by all open files */
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long num_hits = 0;
+static unsigned long num_direct = 0;
+static unsigned long num_underruns = 0;
+static unsigned long long bytes_prefetched = 0;
+
+ReadAhead::ReadAhead(int fd, off_t size)
+    : fd (fd), file_size (size), start (0), head (0), length (0),
+      generation (0), next (0), sequential (0),
+      window (readahead_min_window), failed (false), rate_start (0),
+      rate_bytes (0), thread_running (false), stopping (false) {
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&has_data, 0);
+    pthread_cond_init(&wants_data, 0);
+}
+
+ReadAhead::~ReadAhead() {
+    {
+        MutexLock lock(mutex);
+        stopping = true;
+        pthread_cond_broadcast(&wants_data);
+        pthread_cond_broadcast(&has_data);
+    }
+
+    if (thread_running)
+        pthread_join(thread, 0);
+
+    pthread_cond_destroy(&wants_data);
+    pthread_cond_destroy(&has_data);
+    pthread_mutex_destroy(&mutex);
+}
+
+int ReadAhead::read(char *buf, size_t size, off_t offset) {
+    MutexLock lock(mutex);
+
+    bool in_buffer = !ring.empty() && offset >= start &&
+        offset <= start + (off_t) length;
+
+    if (offset == next || in_buffer)
+        sequential++;
+    else
+        sequential = 0;
+    next = offset + size;
+
+    if (failed || stopping || sequential < readahead_trigger ||
+        offset >= file_size || size > readahead_max_window) {
+        // Keep the buffer where the reader will be if it turns sequential
+        reset(next);
+        return read_direct(buf, size, offset);
+    }
+
+    if (ring.empty())
+        ring.resize(readahead_max_window);
+
+    if (!thread_running) {
+        thread_running = !pthread_create(&thread, 0, prefetch_main, this);
+        if (!thread_running) {
+            failed = true;
+            return read_direct(buf, size, offset);
+        }
+    }
+
+    if (!in_buffer) {
+        reset(offset);
+    } else {
+        // Drop what the reader skipped over
+        size_t skip = offset - start;
+        head = (head + skip) % ring.size();
+        length -= skip;
+        start = offset;
+    }
+
+    size_t wanted = min((off_t) size, file_size - offset);
+    window = max(window, wanted);
+
+    unsigned long gen = generation;
+    bool waited = false;
+    pthread_cond_signal(&wants_data);
+
+    while (length < wanted && !failed && !stopping && gen == generation) {
+        waited = true;
+        pthread_cond_wait(&has_data, &mutex);
+    }
+
+    // Another reader moved the buffer, or the thread could not read
+    if (length < wanted || gen != generation)
+        return read_direct(buf, size, offset);
+
+    size_t first = min(wanted, ring.size() - head);
+    memcpy(buf, &ring[head], first);
+    memcpy(buf + first, &ring[0], wanted - first);
+
+    head = (head + wanted) % ring.size();
+    start += wanted;
+    length -= wanted;
+
+    update_window(wanted, waited);
+    pthread_cond_signal(&wants_data);
+
+    MutexLock stats_lock(stats_mutex);
+    num_hits++;
+    if (waited)
+        num_underruns++;
+
+    return wanted;
+}
+
+string ReadAhead::get_statistics() {
+    MutexLock lock(stats_mutex);
+    ostringstream stats;
+
+    stats << "Read-ahead Hits: " << num_hits << endl
+          << "Read-ahead Underruns: " << num_underruns << endl
+          << "Read-ahead Direct Reads: " << num_direct << endl
+          << "Read-ahead Bytes: " << bytes_prefetched << endl;
+
+    return stats.str();
+}
+
+void *ReadAhead::prefetch_main(void *readahead) {
+    ((ReadAhead*) readahead)->prefetch();
+    return 0;
+}
+
+/**
+ * Runs on the background thread, keeping window bytes buffered ahead of the
+ * reader. The data is read straight into the free part of the ring, which the
+ * reader never touches.
+ */
+void ReadAhead::prefetch() {
+    MutexLock lock(mutex);
+
+    while (!stopping) {
+        off_t offset = start + length;
+
+        if (failed || sequential < readahead_trigger || length >= window ||
+            offset >= file_size) {
+            pthread_cond_wait(&wants_data, &mutex);
+            continue;
+        }
+
+        size_t tail = (head + length) % ring.size();
+        size_t size = min(min(readahead_chunk, window - length),
+                          ring.size() - tail);
+        size = min((off_t) size, file_size - offset);
+        unsigned long gen = generation;
+
+        pthread_mutex_unlock(&mutex);
+        ssize_t res = pread(fd, &ring[tail], size, offset);
+        pthread_mutex_lock(&mutex);
+
+        if (gen != generation) // The reader jumped elsewhere
+            continue;
+
+        if (res <= 0) {
+            failed = true;
+        } else {
+            length += res;
+
+            MutexLock stats_lock(stats_mutex);
+            bytes_prefetched += res;
+        }
+
+        pthread_cond_broadcast(&has_data);
+    }
+}
+
+/**
+ * Reads straight from the file. Called with mutex held.
+ */
+int ReadAhead::read_direct(char *buf, size_t size, off_t offset) {
+    int res = pread(fd, buf, size, offset);
+    if (res == -1)
+        return -errno;
+
+    MutexLock stats_lock(stats_mutex);
+    num_direct++;
+
+    return res;
+}
+
+/**
+ * Empties the buffer so that it starts at offset.
+ */
+void ReadAhead::reset(off_t offset) {
+    start = offset;
+    head = 0;
+    length = 0;
+    generation++;
+}
+
+/**
+ * Adjusts the window to hold readahead_seconds worth of reading at the rate
+ * the reader is going. If the reader had to wait the window is too small, so
+ * it is doubled straight away.
+ */
+void ReadAhead::update_window(size_t consumed, bool waited) {
+    double t = fusepod_now();
+
+    if (rate_start == 0)
+        rate_start = t;
+    rate_bytes += consumed;
+
+    if (waited) {
+        window = min(window * 2, ring.size());
+    } else if (t - rate_start >= 1.0) {
+        size_t target = (size_t) (rate_bytes / (t - rate_start) *
+                                  readahead_seconds);
+        window = max(readahead_min_window, min(target, ring.size()));
+        rate_start = t;
+        rate_bytes = 0;
+    }
+}
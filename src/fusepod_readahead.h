@@ -0,0 +1,103 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_readahead.h                                 *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_READAHEAD_H_
+#define _FUSEPOD_READAHEAD_H_
+
+extern "C" {
+#include <pthread.h>
+#include <sys/types.h>
+}
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/**
+ * Reads ahead of a reader of a file on the iPod. Once the reader has read
+ * sequentially a few times, a background thread starts reading ahead into a
+ * ring buffer so that the reader does not wait on the iPod for every chunk.
+ * How far ahead it reads grows with the rate the reader is reading at. Reads
+ * which are not sequential go straight to the file.
+ */
+class ReadAhead {
+  public:
+    /**
+     * @param fd The open file to read. It is not closed by ReadAhead.
+     * @param size The size of the file.
+     */
+    ReadAhead(int fd, off_t size);
+
+    /**
+     * Stops the background thread.
+     */
+    ~ReadAhead();
+
+    /**
+     * Reads like pread(2), but from the ring buffer when possible.
+     * @return The number of bytes read, or -errno.
+     */
+    int read(char *buf, size_t size, off_t offset);
+
+    /**
+     * @return A multiline string with read-ahead statistics of every open
+     * file, in the same format as FUSEPod::get_statistics.
+     */
+    static string get_statistics();
+
+  private:
+    static void *prefetch_main(void *readahead);
+    void prefetch();
+    int read_direct(char *buf, size_t size, off_t offset);
+    void reset(off_t offset);
+    void update_window(size_t consumed, bool waited);
+
+    int fd;
+    off_t file_size;
+
+    /** Ring buffer, allocated once reads become sequential */
+    vector<char> ring;
+    /** File offset of the first buffered byte */
+    off_t start;
+    /** Position of start in ring */
+    size_t head;
+    /** Number of bytes buffered */
+    size_t length;
+    /** Bumped on every reset, so the thread can drop stale data */
+    unsigned long generation;
+
+    /** Where the next sequential read will start */
+    off_t next;
+    /** Number of sequential reads in a row */
+    int sequential;
+    /** How many bytes to keep buffered ahead of the reader */
+    size_t window;
+    /** Set if the thread failed to read. Reads fall back to read_direct */
+    bool failed;
+
+    /** For measuring how fast the reader reads */
+    double rate_start;
+    size_t rate_bytes;
+
+    bool thread_running;
+    bool stopping;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t has_data;
+    pthread_cond_t wants_data;
+};
+
+#endif
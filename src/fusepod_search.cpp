@@ -0,0 +1,143 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_search.cpp                                  *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_search.h"
+#include "fusepod_util.h"
+
+#include <sstream>
+#include <algorithm>
+#include <iterator>
+#include <cctype>
+
+using namespace std;
+
+void SearchIndex::add(Itdb_Track *track) {
+    remove(track);
+
+    const char *fields[] = {track->title, track->artist, track->album,
+                            track->genre, track->composer};
+
+    vector<string> &mine = track_words[track];
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+        tokenize(fields[i], mine);
+
+    sort(mine.begin(), mine.end());
+    mine.erase(unique(mine.begin(), mine.end()), mine.end());
+
+    for (size_t i = 0; i < mine.size(); i++) {
+        Postings &postings = words[mine[i]];
+        postings.insert(lower_bound(postings.begin(), postings.end(), track),
+                        track);
+    }
+}
+
+void SearchIndex::remove(Itdb_Track *track) {
+    map<Itdb_Track*, vector<string> >::iterator t = track_words.find(track);
+    if (t == track_words.end())
+        return;
+
+    for (size_t i = 0; i < t->second.size(); i++) {
+        map<string, Postings>::iterator w = words.find(t->second[i]);
+        if (w == words.end())
+            continue;
+
+        Postings::iterator p = lower_bound(w->second.begin(), w->second.end(),
+                                           track);
+        if (p != w->second.end() && *p == track)
+            w->second.erase(p);
+        if (w->second.empty())
+            words.erase(w);
+    }
+
+    track_words.erase(t);
+}
+
+void SearchIndex::find(const string &query, vector<Itdb_Track*> &tracks) {
+    vector<string> terms;
+    tokenize(query.c_str(), terms);
+
+    tracks.clear();
+
+    for (size_t i = 0; i < terms.size(); i++) {
+        Postings matches;
+        find_prefix(terms[i], matches);
+
+        if (i == 0) {
+            tracks.swap(matches);
+        } else {
+            Postings both;
+            set_intersection(tracks.begin(), tracks.end(), matches.begin(),
+                             matches.end(), back_inserter(both));
+            tracks.swap(both);
+        }
+
+        if (tracks.empty())
+            return;
+    }
+}
+
+/**
+ * Finds the tracks with a word starting with prefix, sorted by address.
+ */
+void SearchIndex::find_prefix(const string &prefix, Postings &tracks) {
+    map<string, Postings>::iterator w = words.lower_bound(prefix);
+    map<string, Postings>::iterator first = w;
+    size_t count = 0;
+
+    for (; w != words.end() && w->first.compare(0, prefix.size(), prefix) == 0;
+         ++w)
+        count++;
+
+    // The usual case is a whole word, whose postings are already sorted
+    if (count == 1) {
+        tracks = first->second;
+        return;
+    }
+
+    for (w = first; count > 0; ++w, count--)
+        tracks.insert(tracks.end(), w->second.begin(), w->second.end());
+
+    sort(tracks.begin(), tracks.end());
+    tracks.erase(unique(tracks.begin(), tracks.end()), tracks.end());
+}
+
+void SearchIndex::tokenize(const char *text, vector<string> &words) {
+    if (!text)
+        return;
+
+    string word;
+    for (const char *c = text; ; c++) {
+        // Multibyte UTF-8 characters are kept in words, and their case is
+        // folded with the rest of the word
+        unsigned char ch = *c;
+        if (ch && (isalnum(ch) || ch >= 0x80)) {
+            word += ch;
+        } else {
+            if (!word.empty())
+                words.push_back(fusepod_fold_case(word));
+            word.clear();
+            if (!ch)
+                break;
+        }
+    }
+}
+
+string SearchIndex::get_statistics() {
+    ostringstream stats;
+
+    stats << "Search Words: " << words.size() << endl
+          << "Search Tracks: " << track_words.size() << endl;
+
+    return stats.str();
+}
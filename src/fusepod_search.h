@@ -0,0 +1,75 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_search.h                                    *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_SEARCH_H_
+#define _FUSEPOD_SEARCH_H_
+
+#include <gpod/itdb.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+using std::string;
+using std::vector;
+using std::map;
+
+/**
+ * Finds tracks by the words in their title, artist, album, genre and
+ * composer. Words are case folded runs of letters and digits, and each word
+ * maps to the tracks which have it, sorted so they can be intersected
+ * quickly. Not thread safe; callers hold FUSEPod::mutex.
+ */
+class SearchIndex {
+  public:
+    /**
+     * Adds a track, or updates it if its tags have changed.
+     */
+    void add(Itdb_Track *track);
+
+    /**
+     * Removes a track.
+     */
+    void remove(Itdb_Track *track);
+
+    /**
+     * Finds the tracks which have every word of query, or a word starting
+     * with it, eg "def chan" finds "Deftones - Change".
+     * @param tracks Set to the matching tracks.
+     */
+    void find(const string &query, vector<Itdb_Track*> &tracks);
+
+    /**
+     * Splits text into case folded words.
+     */
+    static void tokenize(const char *text, vector<string> &words);
+
+    /**
+     * @return A multiline string with statistics, in the same format as
+     * FUSEPod::get_statistics.
+     */
+    string get_statistics();
+
+  private:
+    typedef vector<Itdb_Track*> Postings;
+
+    void find_prefix(const string &prefix, Postings &tracks);
+
+    /** The tracks with each word, sorted by address */
+    map<string, Postings> words;
+    /** The words of each track, so it can be removed */
+    map<Itdb_Track*, vector<string> > track_words;
+};
+
+#endif
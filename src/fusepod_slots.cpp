@@ -0,0 +1,143 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_slots.cpp                                   *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_slots.h"
+#include "fusepod_util.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+
+extern "C" {
+#include <dirent.h>
+}
+
+using namespace std;
+
+static const char *music_prefix = ":iPod_Control:Music:F";
+
+static string lower_case(string s) {
+    for (size_t i = 0; i < s.size(); i++)
+        s[i] = tolower(s[i]);
+    return s;
+}
+
+SlotAllocator::SlotAllocator(const string &music_dir, int num_dirs)
+    : music_dir (music_dir), num_dirs (num_dirs), scanned (false),
+      next_number (rand() % 1000000), names (num_dirs),
+      exists (num_dirs, false) {
+    pthread_mutex_init(&mutex, 0);
+}
+
+SlotAllocator::~SlotAllocator() {
+    pthread_mutex_destroy(&mutex);
+}
+
+bool SlotAllocator::allocate(const string &ext, string &ipod_path) {
+    MutexLock lock(mutex);
+
+    scan();
+
+    // Balance the directories by using the one with the fewest files
+    int dir = -1;
+    for (int i = 0; i < num_dirs; i++)
+        if (exists[i] && (dir == -1 || names[i].size() < names[dir].size()))
+            dir = i;
+
+    if (dir == -1)
+        return false;
+
+    char tmp[32];
+    string name;
+
+    do {
+        next_number = (next_number + 1) % 1000000;
+        snprintf(tmp, sizeof(tmp), "fusepod%06u.", next_number);
+        name = tmp + ext;
+    } while (!names[dir].insert(lower_case(name)).second);
+
+    snprintf(tmp, sizeof(tmp), "%s%02d:", music_prefix, dir);
+    ipod_path = tmp + name;
+
+    return true;
+}
+
+void SlotAllocator::claim(const char *ipod_path) {
+    int dir;
+    string name;
+
+    if (!parse_ipod_path(ipod_path, dir, name))
+        return;
+
+    MutexLock lock(mutex);
+    if (scanned && dir < num_dirs)
+        names[dir].insert(lower_case(name));
+}
+
+void SlotAllocator::release(const char *ipod_path) {
+    int dir;
+    string name;
+
+    if (!parse_ipod_path(ipod_path, dir, name))
+        return;
+
+    MutexLock lock(mutex);
+    if (scanned && dir < num_dirs)
+        names[dir].erase(lower_case(name));
+}
+
+bool SlotAllocator::parse_ipod_path(const char *ipod_path, int &dir,
+                                    string &filename) {
+    if (!ipod_path ||
+        strncasecmp(ipod_path, music_prefix, strlen(music_prefix)) != 0)
+        return false;
+
+    const char *s = ipod_path + strlen(music_prefix);
+    char *end;
+    dir = strtol(s, &end, 10);
+    if (end == s || *end != ':' || dir < 0)
+        return false;
+
+    filename = end + 1;
+    return filename.size() > 0 && filename.find(':') == string::npos;
+}
+
+/**
+ * Reads the names in every Fxx directory. Called with mutex held.
+ */
+void SlotAllocator::scan() {
+    if (scanned)
+        return;
+
+    for (int i = 0; i < num_dirs; i++) {
+        char tmp[8];
+        snprintf(tmp, sizeof(tmp), "/F%02d", i);
+
+        DIR *d = opendir((music_dir + tmp).c_str());
+        if (!d)
+            continue;
+
+        exists[i] = true;
+
+        struct dirent *ent;
+        while ((ent = readdir(d)))
+            if (ent->d_name[0] != '.')
+                names[i].insert(lower_case(ent->d_name));
+
+        closedir(d);
+    }
+
+    scanned = true;
+}
@@ -0,0 +1,88 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_slots.h                                     *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_SLOTS_H_
+#define _FUSEPOD_SLOTS_H_
+
+extern "C" {
+#include <pthread.h>
+}
+
+#include <string>
+#include <vector>
+#include <set>
+
+using std::string;
+using std::vector;
+using std::set;
+
+/**
+ * Hands out unused filenames in the iPod's iPod_Control/Music/Fxx
+ * directories. The names in each directory are read once, the first time a
+ * name is needed, and kept up to date as names are handed out and released,
+ * so finding a free name does not need to look at the iPod. New files go in
+ * the directory with the fewest files.
+ */
+class SlotAllocator {
+  public:
+    /**
+     * @param music_dir The iPod_Control/Music directory.
+     * @param num_dirs The number of Fxx directories the iPod uses.
+     */
+    SlotAllocator(const string &music_dir, int num_dirs);
+    ~SlotAllocator();
+
+    /**
+     * Reserves an unused name.
+     * @param ext The file extension, without the dot.
+     * @param ipod_path Set to the iPod path of the name, eg
+     * ":iPod_Control:Music:F03:fusepod123456.mp3".
+     * @return false if there is no Fxx directory.
+     */
+    bool allocate(const string &ext, string &ipod_path);
+
+    /**
+     * Marks a name as used, eg when a file is added by something else.
+     */
+    void claim(const char *ipod_path);
+
+    /**
+     * Marks a name as unused once its file has been removed.
+     */
+    void release(const char *ipod_path);
+
+    /**
+     * Splits an iPod path into the number of its Fxx directory and its
+     * filename.
+     * @return false if ipod_path is not in a Fxx directory.
+     */
+    static bool parse_ipod_path(const char *ipod_path, int &dir,
+                                string &filename);
+
+  private:
+    void scan();
+
+    string music_dir;
+    int num_dirs;
+    bool scanned;
+    unsigned int next_number;
+
+    /** Lower case names in each Fxx directory. Empty if it doesn't exist */
+    vector<set<string> > names;
+    vector<bool> exists;
+
+    pthread_mutex_t mutex;
+};
+
+#endif
@@ -0,0 +1,101 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_top.cpp                                     *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_top.h"
+
+using namespace std;
+
+Ranking::Ranking(const string &name, Key key, size_t size) {
+    this->name = name;
+    this->key  = key;
+    this->size = size;
+    this->last = entries.end();
+}
+
+/**
+ * Larger keys first. Ties go by address, which unlike the dbid never
+ * changes while the track is in the set.
+ */
+bool Ranking::Order::operator()(const Entry &a, const Entry &b) const {
+    if (a.first != b.first)
+        return a.first > b.first;
+    return a.second < b.second;
+}
+
+bool Ranking::add(Itdb_Track *track) {
+    guint64 k = key(track);
+    if (k == 0 || size == 0 || keys.count(track))
+        return false;
+
+    keys[track] = k;
+    Entry entry(k, track);
+    entries.insert(entry);
+
+    if (entries.size() <= size) {
+        last = entries.size() == size ? --entries.end() : entries.end();
+        return true;
+    }
+
+    // The entry pushes the old last one out of the top
+    if (Order()(entry, *last)) {
+        --last;
+        return true;
+    }
+
+    return false;
+}
+
+bool Ranking::remove(Itdb_Track *track) {
+    map<Itdb_Track*, guint64>::iterator k = keys.find(track);
+    if (k == keys.end())
+        return false;
+
+    Entries::iterator i = entries.find(Entry(k->second, track));
+    keys.erase(k);
+    if (i == entries.end())
+        return false;
+
+    if (entries.size() <= size) {
+        entries.erase(i);
+        last = entries.end();
+        return true;
+    }
+
+    // The entry after the last one moves into the top
+    bool changed = i == last || Order()(*i, *last);
+    if (changed)
+        ++last;
+    entries.erase(i);
+
+    return changed;
+}
+
+void Ranking::top(vector<Itdb_Track*> &tracks) const {
+    tracks.clear();
+    for (Entries::const_iterator i = entries.begin();
+         i != entries.end() && tracks.size() < size; ++i)
+        tracks.push_back(i->second);
+}
+
+guint64 Ranking::by_playcount(Itdb_Track *track) {
+    return track->playcount;
+}
+
+guint64 Ranking::by_rating(Itdb_Track *track) {
+    return track->rating / ITDB_RATING_STEP;
+}
+
+guint64 Ranking::by_time_added(Itdb_Track *track) {
+    return track->time_added;
+}
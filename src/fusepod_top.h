@@ -0,0 +1,94 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_top.h                                       *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_TOP_H_
+#define _FUSEPOD_TOP_H_
+
+#include <gpod/itdb.h>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <utility>
+
+using std::string;
+using std::vector;
+using std::set;
+using std::map;
+using std::pair;
+
+/**
+ * Keeps every track ordered by a key, eg its play count, so the first few
+ * can be listed without sorting the library. Tracks whose key is 0 are
+ * left out. Adding and removing a track takes O(log n). Not thread safe;
+ * callers hold FUSEPod::mutex.
+ */
+class Ranking {
+  public:
+    typedef guint64 (*Key)(Itdb_Track *track);
+
+    /**
+     * @param name The name of the ranking's directory, eg "Most Played".
+     * @param key Gives the key of a track. Larger keys come first.
+     * @param size How many tracks are in the top of the ranking.
+     */
+    Ranking(const string &name, Key key, size_t size);
+
+    const string &get_name() const { return name; }
+    size_t get_size() const { return size; }
+
+    /**
+     * Adds a track. Remove it first if its key has changed.
+     * @return true if the top of the ranking changed.
+     */
+    bool add(Itdb_Track *track);
+
+    /**
+     * Removes a track.
+     * @return true if the top of the ranking changed.
+     */
+    bool remove(Itdb_Track *track);
+
+    /**
+     * @param tracks Set to the top of the ranking, in order.
+     */
+    void top(vector<Itdb_Track*> &tracks) const;
+
+    /** Keys for the built in rankings */
+    static guint64 by_playcount(Itdb_Track *track);
+    static guint64 by_rating(Itdb_Track *track);
+    static guint64 by_time_added(Itdb_Track *track);
+
+  private:
+    typedef pair<guint64, Itdb_Track*> Entry;
+
+    struct Order {
+        bool operator()(const Entry &a, const Entry &b) const;
+    };
+
+    typedef set<Entry, Order> Entries;
+
+    string name;
+    Key key;
+    size_t size;
+
+    Entries entries;
+    /** The last entry in the top, or entries.end() if all of them are */
+    Entries::iterator last;
+    /** The key each track was added with, so it can be found again */
+    map<Itdb_Track*, guint64> keys;
+};
+
+#endif
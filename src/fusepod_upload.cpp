@@ -0,0 +1,174 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_upload.cpp                                  *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_upload.h"
+#include "fusepod_ipod.h"
+#include "fusepod_util.h"
+#include "fusepod_constants.h"
+#include "fusepod_slots.h"
+#include "fusepod_events.h"
+
+#include <iostream>
+#include <sstream>
+
+extern "C" {
+#include <unistd.h>
+}
+
+using namespace std;
+
+UploadQueue::UploadQueue(FUSEPod *fusepod, size_t capacity, int num_workers)
+    : fusepod (fusepod), capacity (capacity), stopping (false), active (0),
+      num_completed (0), num_failed (0), num_skipped (0) {
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&not_empty, 0);
+    pthread_cond_init(&not_full, 0);
+    pthread_cond_init(&idle, 0);
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, 0, worker_main, this) == 0)
+            workers.push_back(thread);
+    }
+}
+
+UploadQueue::~UploadQueue() {
+    {
+        MutexLock lock(mutex);
+        stopping = true;
+        pthread_cond_broadcast(&not_empty);
+    }
+
+    for (size_t i = 0; i < workers.size(); i++)
+        pthread_join(workers[i], 0);
+
+    pthread_cond_destroy(&idle);
+    pthread_cond_destroy(&not_full);
+    pthread_cond_destroy(&not_empty);
+    pthread_mutex_destroy(&mutex);
+}
+
+void UploadQueue::push(const UploadJob &job) {
+    MutexLock lock(mutex);
+
+    while (jobs.size() >= capacity && !workers.empty())
+        pthread_cond_wait(&not_full, &mutex);
+
+    jobs.push_back(job);
+    pthread_cond_signal(&not_empty);
+}
+
+void UploadQueue::wait() {
+    MutexLock lock(mutex);
+
+    while ((!jobs.empty() || active > 0) && !workers.empty())
+        pthread_cond_wait(&idle, &mutex);
+}
+
+size_t UploadQueue::pending() {
+    MutexLock lock(mutex);
+    return jobs.size() + active;
+}
+
+string UploadQueue::get_statistics() {
+    MutexLock lock(mutex);
+    ostringstream stats;
+
+    stats << "Uploads Pending: " << jobs.size() + active << endl
+          << "Uploads Completed: " << num_completed << endl
+          << "Uploads Failed: " << num_failed << endl
+          << "Uploads Skipped: " << num_skipped << endl;
+
+    for (deque<string>::iterator i = failures.begin(); i != failures.end();
+         ++i)
+        stats << "Failed Upload: " << *i << endl;
+
+    return stats.str();
+}
+
+void *UploadQueue::worker_main(void *queue) {
+    ((UploadQueue*) queue)->run();
+    return 0;
+}
+
+void UploadQueue::run() {
+    for (;;) {
+        UploadJob job;
+
+        {
+            MutexLock lock(mutex);
+
+            while (jobs.empty() && !stopping)
+                pthread_cond_wait(&not_empty, &mutex);
+
+            // Only stop once the queue has been drained
+            if (jobs.empty())
+                break;
+
+            job = jobs.front();
+            jobs.pop_front();
+            active++;
+            pthread_cond_signal(&not_full);
+        }
+
+        fusepod->events->post("upload-started", job.path);
+
+        Track *track;
+        bool duplicate = false;
+        if (job.ipod_path != "")
+            track = fusepod->adopt_song(job.path, job.ipod_path, job.tags);
+        else
+            track = fusepod->upload_song(job.path, job.copy, &duplicate);
+
+        if (!track && job.source != "")
+            track = fusepod->upload_song(job.source, true, &duplicate);
+
+        if (track && !duplicate) {
+            MutexLock lock(fusepod->mutex);
+            fusepod->add_track(track);
+        } else if (!track && !job.copy && job.source == "") {
+            // Moved files are owned by FUSEPod. Don't leave them lying around.
+            unlink(job.path.c_str());
+            if (job.ipod_path != "")
+                fusepod->slots->release(job.ipod_path.c_str());
+        }
+
+        // Songs already on the iPod are skipped, and the iPod is unchanged
+        const char *result = duplicate ? "skipped" :
+                             track ? "finished" : "failed";
+        cout << "Adding track " << job.path << "... "
+             << (duplicate ? "Already on the iPod" :
+                 track ? "Successful" : "Failed") << endl;
+        fusepod->events->post(string("upload-") + result, job.path);
+
+        MutexLock lock(mutex);
+        active--;
+        if (duplicate)
+            num_skipped++;
+        else if (track)
+            num_completed++;
+        else
+            record_failure(job.path);
+
+        if (jobs.empty() && active == 0)
+            pthread_cond_broadcast(&idle);
+    }
+}
+
+void UploadQueue::record_failure(const string &path) {
+    num_failed++;
+    failures.push_back(path);
+    if (failures.size() > upload_failures_kept)
+        failures.pop_front();
+}
@@ -0,0 +1,124 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_upload.h                                    *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_UPLOAD_H_
+#define _FUSEPOD_UPLOAD_H_
+
+extern "C" {
+#include <pthread.h>
+}
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <map>
+
+using std::string;
+using std::deque;
+using std::vector;
+using std::map;
+
+class FUSEPod;
+
+/**
+ * A song waiting to be uploaded to the iPod.
+ */
+struct UploadJob {
+    UploadJob(const string &path = "", bool copy = true,
+              const string &ipod_path = "")
+        : path (path), copy (copy), ipod_path (ipod_path) {}
+    /** Absolute path of the song to upload */
+    string path;
+    /**
+     * If false the song is moved onto the iPod instead of copied, and is
+     * removed if it can't be added
+     */
+    bool copy;
+    /**
+     * If set the song is already in the iPod's Music directory at this iPod
+     * path, and is only added to the iTunesDB.
+     */
+    string ipod_path;
+    /** Tags to use instead of those in the song, see FUSEPod::adopt_song */
+    map<char, string> tags;
+    /**
+     * For a song copied by an interrupted sync, the song it was copied
+     * from. If the copy can't be added this is uploaded instead, and the
+     * copy is left alone.
+     */
+    string source;
+};
+
+/**
+ * A bounded queue of songs which are uploaded by worker threads. Tag
+ * parsing and copying happen on the workers, so whoever queues a song does
+ * not have to wait for it. Once uploaded a song is added to the FUSEPod
+ * filesystem layout.
+ */
+class UploadQueue {
+  public:
+    UploadQueue(FUSEPod *fusepod, size_t capacity, int num_workers);
+
+    /**
+     * Waits for all queued songs to be uploaded and stops the workers.
+     */
+    ~UploadQueue();
+
+    /**
+     * Queues a song for uploading. If the queue is full this blocks until a
+     * worker has made space. Do not call this while holding FUSEPod::mutex,
+     * the workers need it to finish their uploads.
+     */
+    void push(const UploadJob &job);
+
+    /**
+     * Blocks until every queued song has been uploaded.
+     */
+    void wait();
+
+    /**
+     * @return The number of songs queued or being uploaded.
+     */
+    size_t pending();
+
+    /**
+     * @return A multiline string with upload statistics, in the same format
+     * as FUSEPod::get_statistics.
+     */
+    string get_statistics();
+
+  private:
+    static void *worker_main(void *queue);
+    void run();
+    void record_failure(const string &path);
+
+    FUSEPod *fusepod;
+    size_t capacity;
+    deque<UploadJob> jobs;
+    vector<pthread_t> workers;
+    bool stopping;
+    int active;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_cond_t idle;
+
+    unsigned long num_completed;
+    unsigned long num_failed;
+    unsigned long num_skipped;
+    deque<string> failures;
+};
+
+#endif
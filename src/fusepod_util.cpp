@@ -16,10 +16,32 @@
 
 #include <stdio.h>
 #include <cstring>
+#include <cstdlib>
+#include <cctype>
 #include <set>
+#include <istream>
+
+extern "C" {
+#include <sys/time.h>
+#include <glib.h>
+}
 
 static std::set<const char*, ltcasestr> fusepod_strings;
 
+void fusepod_init_recursive_mutex(pthread_mutex_t *mutex) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+double fusepod_now() {
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
 void fusepod_replace_reserved_chars(std::string &ret) {
     for (unsigned int i = 0; i < ret.size(); i++) {
         if (ret[i] == '/' || ret[i] == '~') {
@@ -36,6 +58,20 @@ string fusepod_strip_string(const string &s) {
     return s.substr(l, r + 1 - l);
 }
 
+string fusepod_fold_case(const string &s) {
+    if (!g_utf8_validate(s.c_str(), s.size(), 0)) {
+        string ret = s;
+        for (size_t i = 0; i < ret.size(); i++)
+            ret[i] = tolower(ret[i]);
+        return ret;
+    }
+
+    gchar *folded = g_utf8_casefold(s.c_str(), s.size());
+    string ret = folded;
+    g_free(folded);
+    return ret;
+}
+
 string fusepod_check_string(const string &s, const string &unknown) {
     string ret = fusepod_strip_string(s);
     if (ret == "")
@@ -53,6 +89,23 @@ const char *fusepod_get_string(const char *s) {
     return *i;
 }
 
+const char *StringPool::get(const char *s) {
+    std::set<const char*, ltcasestr>::iterator i = strings.find(s);
+    if (i != strings.end())
+        return *i;
+
+    const char *copy = strdup(s);
+    strings.insert(copy);
+    return copy;
+}
+
+void StringPool::merge() {
+    for (std::set<const char*, ltcasestr>::iterator i = strings.begin();
+         i != strings.end(); ++i)
+        fusepod_strings.insert(*i);
+    strings.clear();
+}
+
 vector<char*> fusepod_split_path(char *s, char c) {
     vector<char*> nodes;
     if (*s != c && *s != 0)
@@ -84,3 +137,59 @@ string fusepod_int_to_string(int i) {
     sprintf(tmp, "%d", i);
     return string(tmp);
 }
+
+string fusepod_get_option(const Options &options, const string &name,
+                          const string &def) {
+    Options::const_iterator i = options.find(name);
+    return i == options.end() ? def : i->second;
+}
+
+long long fusepod_get_size_option(const Options &options, const string &name,
+                                  long long def) {
+    string value = fusepod_get_option(options, name);
+    if (value.empty())
+        return def;
+
+    char *end;
+    long long size = strtoll(value.c_str(), &end, 10);
+
+    switch (*end) {
+        case 'G': case 'g':
+            size *= 1024;
+            /* fall through */
+        case 'M': case 'm':
+            size *= 1024;
+            /* fall through */
+        case 'K': case 'k':
+            size *= 1024;
+    }
+
+    return size;
+}
+
+string fusepod_expand_home(const string &path) {
+    if (path.size() > 0 && path[0] == '~' && getenv("HOME"))
+        return getenv("HOME") + path.substr(1);
+    return path;
+}
+
+vector<string> fusepod_read_config(std::istream &config, Options &options) {
+    vector<string> paths;
+    string line;
+
+    while (!config.eof()) {
+        getline(config, line);
+        line = fusepod_strip_string(line);
+        if (line.length() == 0 || line[0] == '#')
+            continue;
+
+        size_t eq = line.find('=');
+        if (line[0] == '/')
+            paths.push_back(line);
+        else if (eq != string::npos)
+            options[fusepod_strip_string(line.substr(0, eq))] =
+                fusepod_strip_string(line.substr(eq + 1));
+    }
+
+    return paths;
+}
@@ -17,10 +17,24 @@
 
 #include <vector>
 #include <string>
+#include <map>
+#include <set>
+#include <iosfwd>
 #include <cstring>
 
+extern "C" {
+#include <pthread.h>
+}
+
 using std::string;
 using std::vector;
+using std::map;
+
+/**
+ * Settings from the configuration file, which are lines of the form
+ * "name = value".
+ */
+typedef map<string, string> Options;
 
 /**
  * Function object which return compares 2 strings ignoring case.
@@ -31,6 +45,29 @@ struct ltcasestr {
     }
 };
 
+/**
+ * Locks a mutex for the lifetime of the object.
+ */
+class MutexLock {
+  public:
+    MutexLock(pthread_mutex_t &mutex) : mutex(mutex) {
+        pthread_mutex_lock(&mutex);
+    }
+    ~MutexLock() { pthread_mutex_unlock(&mutex); }
+  private:
+    pthread_mutex_t &mutex;
+};
+
+/**
+ * Initialises a mutex which may be locked more than once by the same thread.
+ */
+void fusepod_init_recursive_mutex(pthread_mutex_t *mutex);
+
+/**
+ * @returns The time in seconds, with microseconds.
+ */
+double fusepod_now();
+
 /**
  * Removes characters not allowed in filenames.
  */
@@ -41,6 +78,12 @@ void fusepod_replace_reserved_chars(string &ret);
  */
 string fusepod_strip_string(const string &s);
 
+/**
+ * Folds the case of UTF-8 text, so eg "Émilie" and "éMILIE" compare equal.
+ * Text which isn't UTF-8 is lower cased byte by byte.
+ */
+string fusepod_fold_case(const string &s);
+
 /**
  * Returns a string which has been trimmed/stripped and has had it's reserved
  * characters removed.  If the string ends up being empty, unknown is
@@ -55,6 +98,26 @@ string fusepod_check_string(const string &s, const string &unknown = "Unknown");
  */
 const char *fusepod_get_string(const char *s);
 
+/**
+ * Copies of strings for one thread, like fusepod_get_string, so threads
+ * building parts of the tree don't contend for one set of strings. The
+ * strings live for the whole mount.
+ */
+class StringPool {
+  public:
+    const char *get(const char *s);
+
+    /**
+     * Makes the strings available from fusepod_get_string. A string which
+     * is there already is kept anyway, since nodes point at it. Only call
+     * this from the thread using fusepod_get_string.
+     */
+    void merge();
+
+  private:
+    std::set<const char*, ltcasestr> strings;
+};
+
 /**
  * Modifies the string that is passed by replacing all occurences of
  * c with the NULL character. It then returns a vector of char pointers
@@ -74,4 +137,30 @@ bool fusepod_starts_with(const char *s, const char *prefix);
  */
 string fusepod_int_to_string(int i);
 
+/**
+ * @returns The value of the option called name, or def if it is not set.
+ */
+string fusepod_get_option(const Options &options, const string &name,
+                          const string &def = "");
+
+/**
+ * @returns The value of the option called name as a number of bytes, or def
+ * if it is not set. The value may end in K, M or G.
+ */
+long long fusepod_get_size_option(const Options &options, const string &name,
+                                  long long def);
+
+/**
+ * Reads a configuration file. Lines starting with / are path descriptions,
+ * lines of the form "name = value" are put in options and lines starting
+ * with # are comments.
+ * @returns The path descriptions.
+ */
+vector<string> fusepod_read_config(std::istream &config, Options &options);
+
+/**
+ * Replaces a leading ~ in a path with the home directory.
+ */
+string fusepod_expand_home(const string &path);
+
 #endif
@@ -0,0 +1,72 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_virtual.cpp                                 *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "fusepod_virtual.h"
+
+#include <cstring>
+
+VirtualFile::VirtualFile(int max_age)
+    : content (0), version (0), generated (0), max_age (max_age) {
+}
+
+VirtualFile::~VirtualFile() {
+    if (content)
+        close(content);
+}
+
+VirtualContent *VirtualFile::open() {
+    VirtualContent *c = current();
+    c->refs++;
+    return c;
+}
+
+void VirtualFile::close(VirtualContent *content) {
+    if (--content->refs == 0)
+        delete content;
+}
+
+off_t VirtualFile::size() {
+    return current()->data.size();
+}
+
+int VirtualFile::read(const VirtualContent *content, char *buf, size_t size,
+                      off_t offset) {
+    if (offset < 0 || offset >= (off_t) content->data.size())
+        return 0;
+
+    size_t bytes_read = content->data.size() - offset;
+    if (bytes_read > size)
+        bytes_read = size;
+
+    memcpy(buf, content->data.data() + offset, bytes_read);
+    return bytes_read;
+}
+
+VirtualContent *VirtualFile::current() {
+    unsigned long v = get_version();
+    time_t now = max_age > 0 ? time(0) : 0;
+
+    if (content && v == version && (max_age <= 0 || now - generated < max_age))
+        return content;
+
+    // Readers of the old content keep it until they close
+    if (content)
+        close(content);
+
+    content = new VirtualContent(generate());
+    version = v;
+    generated = now;
+
+    return content;
+}
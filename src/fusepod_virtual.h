@@ -0,0 +1,108 @@
+/******************************* -*- C++ -*- *******************************
+ *                                                                         *
+ *   file            : fusepod_virtual.h                                   *
+ *   date started    : 19 Oct 2026                                         *
+ *   author          : Keegan Carruthers-Smith                             *
+ *   email           : keegan.csmith@gmail.com                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef _FUSEPOD_VIRTUAL_H_
+#define _FUSEPOD_VIRTUAL_H_
+
+extern "C" {
+#include <sys/types.h>
+#include <time.h>
+}
+
+#include <string>
+
+using std::string;
+
+/**
+ * One version of the content of a VirtualFile. It doesn't change, and is
+ * freed once the file and every reader are done with it.
+ */
+struct VirtualContent {
+    VirtualContent(const string &data) : data (data), refs (1) {}
+    string data;
+    int refs;
+};
+
+/**
+ * A file whose content FUSEPod makes, eg the statistics file. The content
+ * is only made again once its version changes, or it gets too old. Readers
+ * keep the version they opened, so they never see half of one version and
+ * half of another. Not thread safe; callers hold FUSEPod::mutex.
+ */
+class VirtualFile {
+  public:
+    /**
+     * @param max_age Seconds after which the content is made again, even
+     * if the version is the same. 0 to keep it until the version changes.
+     */
+    VirtualFile(int max_age = 0);
+    virtual ~VirtualFile();
+
+    /**
+     * @return The current content, which must be given back to close.
+     */
+    VirtualContent *open();
+
+    /**
+     * Gives back content from open.
+     */
+    static void close(VirtualContent *content);
+
+    /**
+     * @return The size of the current content.
+     */
+    off_t size();
+
+    /**
+     * Copies from content. Doesn't need FUSEPod::mutex.
+     * @return The number of bytes copied, which is 0 at the end.
+     */
+    static int read(const VirtualContent *content, char *buf, size_t size,
+                    off_t offset);
+
+  protected:
+    /**
+     * @return A number which changes whenever the content would.
+     */
+    virtual unsigned long get_version() { return 0; }
+
+    /**
+     * @return The content for the current version.
+     */
+    virtual string generate() = 0;
+
+  private:
+    VirtualContent *current();
+
+    VirtualContent *content;
+    unsigned long version;
+    time_t generated;
+    int max_age;
+};
+
+/**
+ * A VirtualFile which never changes, eg a script.
+ */
+class StringFile : public VirtualFile {
+  public:
+    StringFile(const string &text) : text (text) {}
+
+  protected:
+    virtual string generate() { return text; }
+
+  private:
+    string text;
+};
+
+#endif